@@ -0,0 +1,138 @@
+/**
+ * @file gesture_cnn_test.cpp
+ * @brief Runs GestureCNN and the TFLite Micro interpreter on the same inputs
+ * and checks that their logits agree, and times both.
+ */
+#include "gesture_cnn.h"
+#include "model.h"
+#include "resize.h"
+
+#include "tensorflow/lite/micro/micro_interpreter.h"
+#include "tensorflow/lite/micro/micro_mutable_op_resolver.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <random>
+#include <vector>
+
+/// Max logit difference, relative to the logit's magnitude (at least 1).
+static constexpr float kTolerance = 1e-3f;
+/// Exit code ctest reports as skipped.
+static constexpr int kSkipped = 77;
+
+static constexpr int kInputSize = GestureCNN::kInputH * GestureCNN::kInputW;
+static constexpr size_t kArenaSize = 256 * 1024;
+
+/**
+ * @brief Returns the mean time of one call of fn in microseconds.
+ */
+static double time_us(const std::function<void()>& fn) {
+    const int iterations = 200;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        fn();
+    }
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+int main() {
+    const tflite::Model* model = tflite::GetModel(model_tflite);
+    if (model->version() != TFLITE_SCHEMA_VERSION) {
+        printf("FAIL model schema version %lu\n", (unsigned long)model->version());
+        return 1;
+    }
+
+    // The specialized backend only handles the float model, see TFLiteModel::init_specialized()
+    const tflite::SubGraph* graph = model->subgraphs()->Get(0);
+    if (graph->tensors()->Get(graph->inputs()->Get(0))->type() != tflite::TensorType_FLOAT32) {
+        printf("models/model.cc is not the float model, nothing to compare\n");
+        return kSkipped;
+    }
+    auto cnn = std::make_unique<GestureCNN>();
+    if (!cnn->load(model)) {
+        printf("FAIL GestureCNN::load() rejected the float model\n");
+        return 1;
+    }
+
+    // Same operators as TFLiteModel::init()
+    tflite::MicroMutableOpResolver<9> op_resolver;
+    op_resolver.AddConv2D();
+    op_resolver.AddDepthwiseConv2D();
+    op_resolver.AddRelu();
+    op_resolver.AddMaxPool2D();
+    op_resolver.AddReshape();
+    op_resolver.AddFullyConnected();
+    op_resolver.AddTranspose();
+    op_resolver.AddQuantize();
+    op_resolver.AddDequantize();
+
+    std::vector<uint8_t> arena(kArenaSize);
+    tflite::MicroInterpreter interpreter(model, op_resolver, arena.data(), arena.size());
+    if (interpreter.AllocateTensors() != kTfLiteOk) {
+        printf("FAIL AllocateTensors()\n");
+        return 1;
+    }
+    TfLiteTensor* input = interpreter.input(0);
+    TfLiteTensor* output = interpreter.output(0);
+    if (input->bytes != kInputSize * sizeof(float) || output->bytes != GestureCNN::kClasses * sizeof(float)) {
+        printf("FAIL unexpected tensor sizes %zu, %zu\n", input->bytes, output->bytes);
+        return 1;
+    }
+
+    // Pixels as preprocessing produces them: 8-bit values normalized to [-1, 1]
+    struct Case {
+        const char* name;
+        std::function<uint8_t(int x, int y)> pixel;
+    };
+    std::mt19937 rng(1);
+    const Case cases[] = {
+        {"all 0", [](int, int) { return 0; }},
+        {"all 255", [](int, int) { return 255; }},
+        {"horizontal gradient", [](int x, int) { return x * 255 / (GestureCNN::kInputW - 1); }},
+        {"checkerboard", [](int x, int y) { return (x / 4 + y / 4) % 2 ? 255 : 0; }},
+        {"centered blob", [](int x, int y) { return (x - 16) * (x - 16) + (y - 12) * (y - 12) < 64 ? 220 : 30; }},
+        {"noise 1", [&](int, int) { return (uint8_t)rng(); }},
+        {"noise 2", [&](int, int) { return (uint8_t)rng(); }},
+    };
+
+    int failures = 0;
+    float image[kInputSize];
+    float logits[GestureCNN::kClasses];
+    for (const Case& c : cases) {
+        for (int y = 0; y < GestureCNN::kInputH; y++) {
+            for (int x = 0; x < GestureCNN::kInputW; x++) {
+                image[y * GestureCNN::kInputW + x] = normalize_pixel(c.pixel(x, y));
+            }
+        }
+
+        // A 1-channel image has the same memory layout in NCHW and NHWC
+        std::copy(image, image + kInputSize, input->data.f);
+        if (interpreter.Invoke() != kTfLiteOk) {
+            printf("FAIL %s: Invoke()\n", c.name);
+            failures++;
+            continue;
+        }
+        cnn->run(image, logits);
+
+        float worst = 0.0f;
+        for (int i = 0; i < GestureCNN::kClasses; i++) {
+            const float reference = output->data.f[i];
+            worst = std::max(worst, std::fabs(logits[i] - reference) / std::max(1.0f, std::fabs(reference)));
+        }
+        const bool ok = worst <= kTolerance;
+        failures += !ok;
+        printf("%-4s %-20s max relative |diff| %g\n", ok ? "ok" : "FAIL", c.name, worst);
+    }
+
+    double interpreter_us = time_us([&] { interpreter.Invoke(); });
+    double specialized_us = time_us([&] { cnn->run(image, logits); });
+    printf("\ninterpreter %.1f us, specialized %.1f us per inference\n", interpreter_us, specialized_us);
+
+    printf(failures ? "%d inputs failed\n" : "All inputs agree\n", failures);
+    return failures ? 1 : 0;
+}
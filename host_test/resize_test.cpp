@@ -0,0 +1,161 @@
+/**
+ * @file resize_test.cpp
+ * @brief Checks ResizePlan against the per-pixel float loop it replaced and a
+ * reference box average, and ResizeStream against ResizePlan, and times the
+ * float loop and both resize modes.
+ */
+#include "resize.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+/**
+ * @brief The original resize_and_normalize_grayscale() loop.
+ */
+static void float_loop(const uint8_t *src, int src_w, int src_h, float *dst, int dst_w, int dst_h) {
+    float scale_x = (float)src_w / dst_w;
+    float scale_y = (float)src_h / dst_h;
+
+    for (int y = 0; y < dst_h; y++) {
+        for (int x = 0; x < dst_w; x++) {
+            int src_x = (int)(x * scale_x);
+            int src_y = (int)(y * scale_y);
+            uint8_t pixel = src[src_y * src_w + src_x];
+            dst[y * dst_w + x] = normalize_pixel(pixel); // the sampling is what is compared
+        }
+    }
+}
+
+/**
+ * @brief Rounded mean of the source area [i * src / dst, (i + 1) * src / dst) of every output pixel.
+ */
+static void box_reference(const uint8_t *src, int src_w, int src_h, uint8_t *dst, int dst_w, int dst_h) {
+    for (int y = 0; y < dst_h; y++) {
+        int y0 = std::min(y * src_h / dst_h, src_h - 1);
+        int y1 = std::max((y + 1) * src_h / dst_h, y0 + 1);
+        for (int x = 0; x < dst_w; x++) {
+            int x0 = std::min(x * src_w / dst_w, src_w - 1);
+            int x1 = std::max((x + 1) * src_w / dst_w, x0 + 1);
+            double sum = 0;
+            for (int sy = y0; sy < y1; sy++) {
+                for (int sx = x0; sx < x1; sx++) {
+                    sum += src[sy * src_w + sx];
+                }
+            }
+            dst[y * dst_w + x] = (uint8_t)(sum / ((y1 - y0) * (x1 - x0)) + 0.5);
+        }
+    }
+}
+
+/**
+ * @brief Returns the mean time of one call of fn in microseconds.
+ */
+template <typename F>
+static double time_us(F fn) {
+    const int iterations = 2000;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        fn();
+    }
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+int main() {
+    struct Geometry {
+        int src_w, src_h, dst_w, dst_h;
+    };
+    const Geometry geometries[] = {
+        {96, 96, 32, 32},   // the camera frame to the model input
+        {160, 120, 32, 32},
+        {97, 61, 32, 32},
+        {33, 33, 32, 32},
+        {31, 17, 32, 32},   // upscale
+        {32, 32, 32, 32},   // identity
+        {1, 1, 32, 32},
+        {1000, 800, 32, 32}, // box areas too large for the reciprocal table
+    };
+
+    std::vector<uint8_t> identity(256);
+    for (int i = 0; i < 256; i++) {
+        identity[i] = i;
+    }
+
+    std::mt19937 rng(1);
+    int failures = 0;
+    printf("%-18s %12s %12s %12s\n", "geometry", "float [us]", "nearest [us]", "box [us]");
+    for (const Geometry &g : geometries) {
+        std::vector<uint8_t> src(g.src_w * g.src_h);
+        for (uint8_t &p : src) {
+            p = rng();
+        }
+        const int n = g.dst_w * g.dst_h;
+
+        // Nearest is bit-exact with the float loop
+        std::vector<float> expected(n), nearest(n);
+        auto nearest_plan = ResizePlan::get(g.src_w, g.src_h, g.dst_w, g.dst_h, ResizeMode::Nearest);
+        float_loop(src.data(), g.src_w, g.src_h, expected.data(), g.dst_w, g.dst_h);
+        nearest_plan->run(src.data(), nearest.data(), normalize_lut());
+        if (nearest != expected) {
+            printf("FAIL nearest %dx%d -> %dx%d differs from the float loop\n", g.src_w, g.src_h, g.dst_w, g.dst_h);
+            failures++;
+        }
+
+        // Box matches the rounded reference average
+        std::vector<uint8_t> box_expected(n), box(n);
+        auto box_plan = ResizePlan::get(g.src_w, g.src_h, g.dst_w, g.dst_h, ResizeMode::Box);
+        box_reference(src.data(), g.src_w, g.src_h, box_expected.data(), g.dst_w, g.dst_h);
+        box_plan->run(src.data(), box.data(), identity.data());
+        if (box != box_expected) {
+            printf("FAIL box %dx%d -> %dx%d differs from the reference average\n", g.src_w, g.src_h, g.dst_w, g.dst_h);
+            failures++;
+        }
+
+        // Fed in uneven chunks, the stream produces the same image as the plan
+        for (ResizeMode mode : {ResizeMode::Nearest, ResizeMode::Box}) {
+            auto plan = ResizePlan::get(g.src_w, g.src_h, g.dst_w, g.dst_h, mode);
+            std::vector<uint8_t> whole(n), streamed(n);
+            plan->run(src.data(), whole.data(), identity.data());
+            ResizeStream stream(plan, streamed.data());
+            for (size_t offset = 0; offset < src.size();) {
+                size_t len = std::min<size_t>(1 + rng() % 700, src.size() - offset);
+                stream.push(src.data() + offset, len);
+                offset += len;
+            }
+            if (!stream.done() || streamed != whole) {
+                printf("FAIL stream %s %dx%d -> %dx%d differs from the plan\n",
+                       mode == ResizeMode::Box ? "box" : "nearest", g.src_w, g.src_h, g.dst_w, g.dst_h);
+                failures++;
+            }
+        }
+
+        std::vector<float> out(n);
+        double float_us = time_us([&] { float_loop(src.data(), g.src_w, g.src_h, out.data(), g.dst_w, g.dst_h); });
+        double nearest_us = time_us([&] { nearest_plan->run(src.data(), out.data(), normalize_lut()); });
+        double box_us = time_us([&] { box_plan->run(src.data(), out.data(), normalize_lut()); });
+        char name[32];
+        snprintf(name, sizeof(name), "%dx%d->%dx%d", g.src_w, g.src_h, g.dst_w, g.dst_h);
+        printf("%-18s %12.3f %12.3f %12.3f\n", name, float_us, nearest_us, box_us);
+    }
+
+    // The largest /predict upload: 62500-pixel boxes of white must stay white
+    {
+        const int size = 8000;
+        auto plan = ResizePlan::get(size, size, 32, 32, ResizeMode::Box);
+        std::vector<uint8_t> row(size, 255), out(32 * 32);
+        ResizeStream stream(plan, out.data());
+        for (int y = 0; y < size; y++) {
+            stream.push(row.data(), row.size());
+        }
+        if (!stream.done() || std::count(out.begin(), out.end(), 255) != (int)out.size()) {
+            printf("FAIL box 8000x8000 -> 32x32 of white is not white\n");
+            failures++;
+        }
+    }
+
+    printf(failures ? "%d checks failed\n" : "All checks passed\n", failures);
+    return failures ? 1 : 0;
+}
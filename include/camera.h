@@ -4,6 +4,8 @@
 #include "esp_log.h"
 #include "esp_err.h"
 #include "esp_camera.h"
+#include "tensorflow/lite/c/common.h"
+#include "resize.h"
 
 
 #include <memory>
@@ -34,21 +36,37 @@
 /** @} */ // End of Camera GPIO Pin Definitions
 
 
+/**
+ * @brief Returns the smallest camera frame size covering a minimum size.
+ *
+ * @param min_width The minimum frame width.
+ * @param min_height The minimum frame height.
+ * @return The frame size, or FRAMESIZE_INVALID if none is large enough.
+ */
+framesize_t smallest_frame_size(int min_width, int min_height);
+
 /**
  * @brief Configures and initializes the camera.
  *
  * Sets the camera pins, pixel format, frame size, and other parameters. 
- * Corrects image orientation.
+ * Corrects image orientation. The frame size is the smallest one covering
+ * the given minimum, usually the model input size. With CONFIG_CAMERA_JPEG
+ * the sensor encodes JPEG and the minimum is scaled up by the decode scale.
+ * The framebuffer size and capture time are logged.
+ *
+ * @param min_width The minimum frame width.
+ * @param min_height The minimum frame height.
  * @return ESP_OK on success, ESP_FAIL on failure.
  */
-esp_err_t initCamera();
+esp_err_t initCamera(int min_width = 0, int min_height = 0);
 
 
 /**
  * @brief Resizes and normalizes a grayscale image.
  *
  * Takes a grayscale image, resizes it to the specified
- * dimensions, and normalizes the pixel values to the range [0, 1].
+ * dimensions, and normalizes the pixel values to the range [-1, 1] as in
+ * training (see normalize_pixel()).
  *
  * @param src The source image buffer.
  * @param src_w The width of the source image.
@@ -61,23 +79,127 @@ void resize_and_normalize_grayscale(uint8_t *src, int src_w, int src_h,
                                    float *dst, int dst_w, int dst_h);
 
 /**
- * Custom deleter to ensure both the struct and buffer are freed
+ * @brief Resizes, normalizes and quantizes a grayscale image into a model input tensor.
+ *
+ * Reads the tensor's type, layout (NCHW or NHWC, see detect_image_geometry())
+ * and quantization parameters and fills `data.f`, `data.int8` or `data.uint8`
+ * in a single pass. Pixels are normalized
+ * to [-1, 1] as in resize_and_normalize_grayscale() and, for integer tensors,
+ * quantized with the tensor's scale and zero-point.
+ *
+ * @param src The source image buffer.
+ * @param src_w The width of the source image.
+ * @param src_h The height of the source image.
+ * @param[out] input The model input tensor.
+ * @return ESP_OK on success, ESP_ERR_NOT_SUPPORTED for other tensor types,
+ *         non-grayscale inputs or integer inputs without a quantization scale.
+ */
+esp_err_t preprocess_grayscale_to_tensor(const uint8_t *src, int src_w, int src_h,
+                                         TfLiteTensor *input);
+
+/**
+ * @brief Like preprocess_grayscale_to_tensor(), but writes to a separate buffer.
+ *
+ * Lets a frame be preprocessed while the model still runs on the previous one;
+ * the buffer is copied into the input tensor right before invoking.
+ *
+ * @param src The source image buffer.
+ * @param src_w The width of the source image.
+ * @param src_h The height of the source image.
+ * @param input The model input tensor, only its type, shape and quantization are read.
+ * @param[out] dst A buffer of `input->bytes` bytes.
+ * @return ESP_OK on success, ESP_ERR_NOT_SUPPORTED for other tensor types,
+ *         non-grayscale inputs or integer inputs without a quantization scale.
+ */
+esp_err_t preprocess_grayscale(const uint8_t *src, int src_w, int src_h,
+                               const TfLiteTensor *input, void *dst);
+
+/**
+ * @brief Returns the resize plan preprocess_grayscale() uses for a source size.
+ *
+ * Lets an image that arrives in pieces be resized to the model input with a
+ * ResizeStream, the result then goes through preprocess_grayscale() unchanged.
+ *
+ * @param src_w The width of the source image.
+ * @param src_h The height of the source image.
+ * @param input The model input tensor.
+ * @return The plan, or nullptr for non-grayscale inputs or sizes that are not positive.
+ */
+std::shared_ptr<const ResizePlan> preprocess_resize_plan(int src_w, int src_h, const TfLiteTensor *input);
+
+/**
+ * Custom deleter that gives pooled JPEG buffers back to the JpegPool and
+ * frees the struct and buffer of heap-allocated ones
  */ 
 struct CameraFbDeleter{
-    void operator()(camera_fb_t* fb) const {
-        if (fb) {
-            if (fb->buf) {
-                free(fb->buf); // Use free for buffer allocated by frame2jpg
-            }
-            delete fb;
-        }
-    }
+    void operator()(camera_fb_t* fb) const;
 };
 
 
+/**
+ * @brief Decodes a JPEG framebuffer at a reduced scale into grayscale.
+ *
+ * The decoder skips the DCT coefficients the reduction does not need, so a
+ * 1/4 or 1/8 decode costs a fraction of a full one. The image is decoded as
+ * RGB888 and converted to luma in place, so `dst` needs three bytes per
+ * output pixel (see decoded_jpeg_size()).
+ *
+ * @param jpeg_fb The JPEG framebuffer.
+ * @param scale The reduction: 1, 2, 4 or 8.
+ * @param[out] dst The grayscale output.
+ * @param dst_size The size of dst.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for other scales,
+ *         ESP_ERR_INVALID_SIZE if dst is too small, or the decoder's error.
+ */
+esp_err_t decode_jpeg_to_grayscale(const camera_fb_t *jpeg_fb, int scale, uint8_t *dst, size_t dst_size);
+
+/**
+ * @brief Returns the size of a JPEG framebuffer decoded at a reduced scale.
+ */
+inline void decoded_jpeg_size(const camera_fb_t *jpeg_fb, int scale, size_t &width, size_t &height) {
+    width = (jpeg_fb->width + scale - 1) / scale;
+    height = (jpeg_fb->height + scale - 1) / scale;
+}
+
+/**
+ * @brief Reads the size of a JPEG image from its headers, without decoding it.
+ *
+ * @param data The JPEG image.
+ * @param len The size of the image.
+ * @param[out] width The image width.
+ * @param[out] height The image height.
+ * @return ESP_OK on success, or the decoder's error for invalid JPEG data.
+ */
+esp_err_t read_jpeg_size(const uint8_t *data, size_t len, size_t &width, size_t &height);
+
+/**
+ * @brief Copies a JPEG framebuffer, e.g. to hand the sensor's buffer back early.
+ *
+ * @param jpeg_fb The JPEG framebuffer.
+ * @return The copy in a JpegPool buffer (in the heap if none fits), or nullptr on failure.
+ */
+std::unique_ptr<camera_fb_t, CameraFbDeleter> copy_jpeg(const camera_fb_t *jpeg_fb);
+
+/**
+ * @brief Encodes a grayscale framebuffer as JPEG, handing the output to a callback.
+ *
+ * The callback gets every block of output as soon as the encoder produces it,
+ * e.g. to send it to a socket without holding the whole image in memory.
+ *
+ * @param grayscale_fb The grayscale framebuffer to encode.
+ * @param cb Called with the offset, data and length of every block; returning
+ *           less than the length aborts the encode.
+ * @param arg Passed to the callback.
+ * @return True if the whole image was encoded and accepted by the callback.
+ */
+bool encode_grayscale_jpeg(camera_fb_t *grayscale_fb, jpg_out_cb cb, void *arg);
+
 /**
  * @brief Converts a grayscale framebuffer to a JPEG framebuffer.
  *
+ * The JPEG is encoded into a buffer of the JpegPool. Only if the pool is
+ * exhausted or the image does not fit, it is encoded into the heap.
+ *
  * @param grayscale_fb The grayscale framebuffer to convert.
  * @return An unique pointer to a new framebuffer containing the JPEG image, or nullptr on failure.
  */
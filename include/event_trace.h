@@ -0,0 +1,116 @@
+#pragma once
+#include "sdkconfig.h"
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @file event_trace.h
+ * @brief Lightweight begin/end event tracing with Chrome trace export.
+ *
+ * TRACE_SCOPE("name") records the time from the macro to the end of the
+ * enclosing scope, with the task and core it ran on, into a fixed-size PSRAM
+ * ring. /events.json streams the ring as Chrome trace JSON (one process per
+ * core, one thread per task) for chrome://tracing or ui.perfetto.dev.
+ *
+ * Without CONFIG_EVENT_TRACE the macros expand to nothing.
+ */
+
+#ifdef CONFIG_EVENT_TRACE
+
+#include "esp_err.h"
+#include "esp_timer.h"
+
+#include <atomic>
+
+/**
+ * @brief The ring of completed trace events.
+ */
+class EventTrace {
+public:
+    static constexpr size_t kTaskNameLen = 16; ///< configMAX_TASK_NAME_LEN of ESP-IDF.
+
+    /**
+     * @brief A completed scope.
+     */
+    struct Event {
+        const char* name;             ///< Scope name, a string literal.
+        int64_t start_us;             ///< esp_timer time the scope was entered.
+        uint32_t duration_us;         ///< Time spent in the scope.
+        uint32_t task_id;             ///< Task handle, as a number.
+        uint8_t core;                 ///< Core the scope ended on.
+        char task_name[kTaskNameLen]; ///< Name of the task.
+    };
+
+    EventTrace() = delete;
+
+    /**
+     * @brief Allocates the ring. Events recorded before are dropped.
+     *
+     * @param capacity Number of events kept.
+     * @return ESP_OK on success, ESP_ERR_NO_MEM if the ring cannot be allocated.
+     */
+    static esp_err_t init(size_t capacity);
+
+    /**
+     * @brief Records a completed scope of the calling task.
+     */
+    static void record(const char* name, int64_t start_us, int64_t end_us);
+
+    /**
+     * @brief Copies one event out of the ring.
+     *
+     * @param index Event index, between head() - capacity() and head().
+     * @param[out] event The event.
+     * @return False if the event was overwritten or is still being written.
+     */
+    static bool read(uint32_t index, Event& event);
+
+    static uint32_t head() { return head_.load(std::memory_order_acquire); } ///< Index of the next event.
+    static size_t capacity() { return capacity_; } ///< Number of events kept.
+
+private:
+    /**
+     * @brief A ring slot. seq is 2 * index + 1 while being written, 2 * index + 2 when complete.
+     */
+    struct Slot {
+        std::atomic<uint32_t> seq;
+        Event event;
+    };
+
+    static inline Slot* slots_ = nullptr;            ///< The ring, in PSRAM.
+    static inline size_t capacity_ = 0;              ///< Number of slots.
+    static inline std::atomic<uint32_t> head_ = {0}; ///< Index of the next event.
+};
+
+
+/**
+ * @brief Records the lifetime of the object as one event.
+ */
+class EventTraceScope {
+public:
+    explicit EventTraceScope(const char* name) : name_(name), start_us_(esp_timer_get_time()) {}
+    ~EventTraceScope() { EventTrace::record(name_, start_us_, esp_timer_get_time()); }
+
+    EventTraceScope(const EventTraceScope&) = delete;
+    EventTraceScope& operator=(const EventTraceScope&) = delete;
+
+private:
+    const char* name_; ///< Scope name.
+    int64_t start_us_; ///< Time the scope was entered.
+};
+
+#define EVENT_TRACE_CONCAT_(a, b) a##b
+#define EVENT_TRACE_CONCAT(a, b) EVENT_TRACE_CONCAT_(a, b)
+
+/// Traces the rest of the enclosing scope under `name` (a string literal).
+#define TRACE_SCOPE(name) EventTraceScope EVENT_TRACE_CONCAT(event_trace_scope_, __LINE__)(name)
+
+#else
+
+#define TRACE_SCOPE(name) ((void)0)
+
+#endif // CONFIG_EVENT_TRACE
+
+/// Traces the rest of the enclosing function under its name.
+#define TRACE_FUNCTION() TRACE_SCOPE(__func__)
@@ -0,0 +1,135 @@
+#ifndef FRAME_SOURCE_H
+#define FRAME_SOURCE_H
+
+#include "esp_err.h"
+#include "esp_camera.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+
+/**
+ * @brief A source of grayscale frames with the esp_camera_fb_get() / esp_camera_fb_return() contract.
+ *
+ * Everything downstream of the camera takes frames through the configured
+ * source (CONFIG_FRAME_SOURCE), so the pipeline runs unchanged on the
+ * hardware camera, on a synthetic pattern or on frames replayed from flash,
+ * e.g. in QEMU where there is no camera.
+ */
+class FrameSource {
+public:
+    virtual ~FrameSource() = default;
+
+    /**
+     * @brief Creates and initializes the source selected by CONFIG_FRAME_SOURCE.
+     *
+     * @param min_width The smallest useful frame width, usually the model input width.
+     * @param min_height The smallest useful frame height, usually the model input height.
+     * @return ESP_OK on success, an error if the source cannot be initialized.
+     */
+    static esp_err_t initialize(int min_width, int min_height);
+
+    /**
+     * @brief Gets the source created by initialize().
+     *
+     * @return A reference to the source.
+     */
+    static FrameSource& getInstance() {
+        return *instance;
+    }
+
+    /**
+     * @brief Returns the next frame, blocking until it is available.
+     *
+     * @return The frame, or nullptr on failure. It must be given back with fb_return().
+     */
+    virtual camera_fb_t* fb_get() = 0;
+
+    /**
+     * @brief Returns a frame whose capture started after a given time.
+     *
+     * Frames older than `not_before_us` are handed back and the next one is
+     * taken. With CONFIG_CAMERA_FB_COUNT > 1 the driver keeps capturing into
+     * the spare buffers (CAMERA_GRAB_LATEST), so a flush costs at most the rest
+     * of the frame in progress instead of a full extra frame period.
+     *
+     * @param not_before_us The esp_timer time the frame must be captured after.
+     * @return The frame, or nullptr on failure. It must be given back with fb_return().
+     */
+    camera_fb_t* fb_get_fresh(int64_t not_before_us);
+
+    /**
+     * @brief Gives a frame obtained with fb_get() back to the source.
+     *
+     * @param fb The frame.
+     */
+    virtual void fb_return(camera_fb_t* fb) = 0;
+
+    /**
+     * @brief Returns the name of the source for logging.
+     */
+    virtual const char* name() const = 0;
+
+    /**
+     * @brief Counters of fb_get_fresh().
+     */
+    struct Stats {
+        uint32_t fresh_requests;  ///< Calls to fb_get_fresh().
+        uint32_t stale_flushes;   ///< Frames handed back because they were captured too early.
+        int64_t mean_wait_us;     ///< Mean time fb_get_fresh() took.
+        int64_t max_wait_us;      ///< Longest time fb_get_fresh() took.
+        int64_t flush_wait_us;    ///< Total time spent waiting for replacements of flushed frames.
+    };
+
+    /**
+     * @brief Returns a snapshot of the fb_get_fresh() counters.
+     */
+    Stats stats() const;
+
+    /**
+     * @brief Clears the fb_get_fresh() counters.
+     */
+    void reset_stats();
+
+    /**
+     * @brief Returns the esp_timer time a frame was captured at.
+     */
+    static int64_t timestamp_us(const camera_fb_t* fb) {
+        return (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+    }
+
+protected:
+    /**
+     * @brief Initializes the source.
+     *
+     * @param min_width The smallest useful frame width.
+     * @param min_height The smallest useful frame height.
+     */
+    virtual esp_err_t init(int min_width, int min_height) = 0;
+
+private:
+    static inline FrameSource* instance = nullptr; ///< The source created by initialize().
+
+    mutable std::mutex stats_mutex_; ///< Guards the counters.
+    Stats stats_ = {};              ///< fb_get_fresh() counters (mean_wait_us unused).
+    int64_t total_wait_us_ = 0;     ///< Sum of all fb_get_fresh() times.
+};
+
+
+/**
+ * @brief A grayscale frame embedded in the firmware for replay.
+ */
+struct ReplayFrame {
+    const char* name;       ///< File name the frame was read from.
+    uint16_t width;         ///< Frame width.
+    uint16_t height;        ///< Frame height.
+    const uint8_t* pixels;  ///< Grayscale pixels, row-major.
+};
+
+/// Frames generated from CONFIG_FRAME_SOURCE_REPLAY_DIR by scripts/embed_frames.py.
+extern const ReplayFrame replay_frames[];
+/// Number of entries in replay_frames.
+extern const size_t replay_frames_count;
+
+#endif // FRAME_SOURCE_H
@@ -0,0 +1,61 @@
+#pragma once
+#include "tensorflow/lite/schema/schema_generated.h"
+
+/**
+ * @brief Hand-specialized float inference engine for the gesture CNN.
+ *
+ * Runs the fixed network from scripts/cnn.py without the TFLite Micro
+ * interpreter: 32x32x1 -> conv3x3(8)+BN+ReLU+pool -> conv3x3(16)+BN+ReLU+pool
+ * -> FC(576 -> 14). Shapes are compile-time constants, each conv block is a
+ * single fused conv+bias+ReLU+maxpool loop and the layout transposes of the
+ * exported graph are folded into the order the second block writes its output.
+ *
+ * Weights are read from the same flatbuffer the interpreter uses (batch norm
+ * is already folded into the convolutions by the converter).
+ */
+class GestureCNN {
+public:
+    static constexpr int kInputH = 32;  ///< Input height.
+    static constexpr int kInputW = 32;  ///< Input width.
+    static constexpr int kConv1C = 8;   ///< Output channels of the first conv block.
+    static constexpr int kConv2C = 16;  ///< Output channels of the second conv block.
+    static constexpr int kPool1H = (kInputH - 2) / 2; ///< Height after the first block (15).
+    static constexpr int kPool1W = (kInputW - 2) / 2; ///< Width after the first block (15).
+    static constexpr int kPool2H = (kPool1H - 2) / 2; ///< Height after the second block (6).
+    static constexpr int kPool2W = (kPool1W - 2) / 2; ///< Width after the second block (6).
+    static constexpr int kFeatures = kPool2H * kPool2W * kConv2C; ///< Flattened features (576).
+    static constexpr int kClasses = 14; ///< Number of output classes.
+
+    /**
+     * @brief Reads and validates the weights of a float model.
+     *
+     * Fails if the graph is not the expected architecture, is quantized, or
+     * uses different shapes, so the caller can fall back to the interpreter.
+     *
+     * @param model The TFLite model.
+     * @return True if the weights were loaded.
+     */
+    bool load(const tflite::Model* model);
+
+    /**
+     * @brief Runs the network.
+     *
+     * @param input The 32x32 float input image.
+     * @param[out] output The 14 output logits.
+     */
+    void run(const float* input, float* output);
+
+private:
+    static inline const char* TAG = "gesture_cnn"; ///< Tag for logging.
+
+    float conv1_w_[kConv1C * 3 * 3];           ///< First conv filter, [out][ky][kx].
+    float conv1_b_[kConv1C];                   ///< First conv bias.
+    float conv2_w_[kConv2C * 3 * 3 * kConv1C]; ///< Second conv filter, [out][ky][kx][in].
+    float conv2_b_[kConv2C];                   ///< Second conv bias.
+    const float* fc_w_ = nullptr; ///< Fully connected weights, [class][feature], in the model data.
+    const float* fc_b_ = nullptr; ///< Fully connected bias, in the model data.
+    bool flatten_chw_ = false;    ///< Whether the FC layer expects channel-major (NCHW) features.
+
+    float pool1_[kPool1H * kPool1W * kConv1C]; ///< First block output, HWC.
+    float features_[kFeatures];                ///< Second block output, in FC order.
+};
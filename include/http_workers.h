@@ -0,0 +1,68 @@
+#pragma once
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+#include <cstdint>
+
+/**
+ * @brief Small pool of tasks that run slow HTTP handlers off the server task.
+ *
+ * esp_http_server handles one request at a time, so a /capture that waits for
+ * the camera, the model and the encoder would hold up every other request.
+ * submit() detaches such a request with httpd_req_async_handler_begin() and
+ * queues it to one of CONFIG_WEB_ASYNC_WORKERS tasks, and the server task
+ * moves on. When all CONFIG_WEB_ASYNC_QUEUE_DEPTH queue slots are taken the
+ * request is answered with 503 right away instead of piling up.
+ */
+class HttpWorkers {
+public:
+    /// A request handler, as registered with httpd_register_uri_handler().
+    using Handler = esp_err_t (*)(httpd_req_t *req);
+
+    /**
+     * @brief Queue and service counters.
+     */
+    struct Stats {
+        uint32_t submitted;        ///< Requests queued.
+        uint32_t rejected;         ///< Requests answered with 503 because the queue was full.
+        uint32_t completed;        ///< Requests a worker finished.
+        uint32_t queue_depth;      ///< Requests waiting now.
+        uint32_t max_queue_depth;  ///< Most requests waiting at once.
+        uint32_t busy_workers;     ///< Workers running a handler now.
+        int64_t mean_wait_us;      ///< Mean time from submit() to a worker picking the request up.
+        int64_t max_wait_us;       ///< Longest such time.
+        int64_t mean_service_us;   ///< Mean handler time in the workers.
+        int64_t max_service_us;    ///< Longest handler time in the workers.
+    };
+
+    HttpWorkers() = delete;
+
+    /**
+     * @brief Creates the queue and starts the workers.
+     *
+     * @return ESP_OK on success, ESP_ERR_INVALID_STATE if already started,
+     *         ESP_ERR_NO_MEM or ESP_FAIL otherwise.
+     */
+    static esp_err_t start();
+
+    /**
+     * @brief Runs a handler on a worker.
+     *
+     * Runs the handler inline if the workers were not started.
+     *
+     * @param req The request, from the server task.
+     * @param handler The handler to run on the detached request.
+     * @return ESP_OK if queued or answered with 503, an error if the request cannot be detached.
+     */
+    static esp_err_t submit(httpd_req_t *req, Handler handler);
+
+    /**
+     * @brief Returns a snapshot of the counters.
+     */
+    static Stats stats();
+
+    /**
+     * @brief Clears the counters.
+     */
+    static void reset_stats();
+};
@@ -0,0 +1,268 @@
+#ifndef INFERENCE_H
+#define INFERENCE_H
+
+#include "esp_err.h"
+#include "esp_camera.h"
+#include "camera.h"
+#include "motion_gate.h"
+#include "latency_trace.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "tflite_model.h"
+
+#include <memory>
+#include <mutex>
+
+
+/**
+ * @brief The result of running the model on one frame.
+ */
+struct Prediction {
+    static constexpr int kMaxScores = 16; ///< Capacity of the scores array.
+
+    uint32_t frame_id = 0;     ///< Sequence number of the frame (0 for on-demand captures).
+    int class_index = -1;      ///< Index of the detected gesture, -1 if inference failed.
+    float confidence = 0.0f;   ///< Softmax probability of the detected gesture.
+    int num_scores = 0;        ///< Number of valid entries in scores.
+    float scores[kMaxScores] = {}; ///< Dequantized model outputs (logits).
+    bool reused = false;       ///< The motion gate skipped the model and copied the last inferred scores.
+
+    int64_t capture_us = 0;    ///< esp_timer time when the camera captured the frame.
+    int64_t preprocess_us = 0; ///< Time spent resizing and normalizing.
+    int64_t inference_us = 0;  ///< Time spent in TFLiteModel::invoke().
+    int64_t encode_us = 0;     ///< Time spent encoding the JPEG (0 if not encoded).
+    int64_t published_us = 0;  ///< esp_timer time when the result was published.
+
+    FrameTrace trace;          ///< Timestamps of the frame at every stage boundary.
+};
+
+
+/**
+ * @brief Frees memory allocated with heap_caps_malloc().
+ */
+struct HeapCapsDeleter {
+    void operator()(void* p) const { heap_caps_free(p); }
+};
+
+
+/**
+ * @brief A grayscale frame together with the prediction made on it.
+ */
+struct InferenceFrame {
+    Prediction prediction; ///< The prediction made on this frame.
+    size_t width = 0;      ///< Frame width.
+    size_t height = 0;     ///< Frame height.
+    std::unique_ptr<uint8_t, HeapCapsDeleter> pixels; ///< Grayscale pixels (in PSRAM).
+    std::unique_ptr<camera_fb_t, CameraFbDeleter> jpeg; ///< JPEG of the frame (the full-size sensor JPEG with CONFIG_CAMERA_JPEG), or nullptr if not encoded.
+
+    /**
+     * @brief Returns a camera framebuffer view of the pixels, e.g. for JPEG encoding.
+     */
+    camera_fb_t as_fb() const;
+};
+
+
+/**
+ * @brief Runs the model on a grayscale frame.
+ *
+ * Preprocesses the frame into the model input, invokes the model and fills
+ * the scores, argmax and softmax confidence. Calls are serialized, so the
+ * model can be shared by the background task and HTTP handlers.
+ *
+ * @param model The initialized model.
+ * @param pixels The grayscale frame.
+ * @param width The frame width.
+ * @param height The frame height.
+ * @param[out] prediction The result (its frame_id and capture_us are left untouched).
+ * @return ESP_OK on success, an error if preprocessing or inference failed.
+ */
+esp_err_t predict_frame(TFLiteModel* model, const uint8_t* pixels, size_t width, size_t height,
+                        Prediction& prediction);
+
+
+/**
+ * @brief Takes a frame from the camera, copies it and runs the model on it.
+ *
+ * The frame is captured after the call (see FrameSource::fb_get_fresh()).
+ * The camera framebuffer is returned right after the copy, so the sensor can
+ * fill the next frame while the model runs. With CONFIG_MOTION_GATE the model
+ * is skipped and the last prediction reused if the scene has not changed.
+ *
+ * @param model The initialized model.
+ * @param frame_id The sequence number to give the frame.
+ * @return The frame with its prediction, or nullptr on failure.
+ */
+std::shared_ptr<InferenceFrame> capture_and_predict(TFLiteModel* model, uint32_t frame_id);
+
+
+/**
+ * @brief Counters of capture_shared().
+ */
+struct CoalesceStats {
+    uint32_t requests = 0;    ///< Calls to capture_shared().
+    uint32_t flights = 0;     ///< Captures actually executed.
+    uint32_t joined = 0;      ///< Calls that shared another call's capture.
+    uint32_t failed = 0;      ///< Executed captures that failed.
+    uint32_t max_waiters = 0; ///< Most calls that joined a single capture.
+};
+
+
+/**
+ * @brief Captures, predicts, encodes and publishes a frame on demand, shared between concurrent callers.
+ *
+ * The first caller executes capture_and_predict(), encodes the JPEG and
+ * publishes the frame. Callers arriving within CONFIG_CAPTURE_COALESCE_WINDOW_MS
+ * of its start wait for it and get the very same frame and JPEG instead of
+ * running their own, so N simultaneous viewers cost one execution. Joiners may
+ * thus get a frame captured up to the window before their own request. With a
+ * window of 0 nothing is shared and the JPEG is left to the caller. Every
+ * execution gets its own frame id, even when executions overlap.
+ *
+ * @param model The initialized model.
+ * @return The published frame, or nullptr on failure.
+ */
+std::shared_ptr<const InferenceFrame> capture_shared(TFLiteModel* model);
+
+/**
+ * @brief Returns a snapshot of the capture_shared() counters.
+ */
+CoalesceStats capture_shared_stats();
+
+/**
+ * @brief Clears the capture_shared() counters.
+ */
+void reset_capture_shared_stats();
+
+
+/**
+ * @brief Returns the motion gate shared by capture_and_predict() and the pipeline.
+ *
+ * @return The gate, or nullptr if CONFIG_MOTION_GATE is disabled.
+ */
+MotionGate* motion_gate();
+
+
+/**
+ * @brief Publishes a frame as the latest result.
+ *
+ * Readers that still hold the previous frame keep it alive until they are done.
+ *
+ * @param frame The frame to publish.
+ */
+void publish_frame(std::shared_ptr<const InferenceFrame> frame);
+
+/**
+ * @brief Returns the most recently published frame.
+ *
+ * @return The frame, or nullptr if nothing has been published yet.
+ */
+std::shared_ptr<const InferenceFrame> latest_frame();
+
+/**
+ * @brief Waits until a frame is published.
+ *
+ * @param[in,out] seen The frames_published() count the caller has seen; updated
+ *                     to the current count if a frame was published since.
+ * @param timeout_ms How long to wait.
+ * @return The latest frame, or nullptr if none was published since `seen` within the timeout.
+ */
+std::shared_ptr<const InferenceFrame> wait_for_frame(uint32_t& seen, int timeout_ms);
+
+/**
+ * @brief Returns the number of frames published since boot.
+ */
+uint32_t frames_published();
+
+
+/**
+ * @brief Statistics of one pipeline stage.
+ */
+struct StageStats {
+    const char* name = "";         ///< Stage name.
+    uint32_t processed = 0;        ///< Frames the stage completed.
+    uint32_t failed = 0;           ///< Frames the stage failed on (and discarded).
+    uint32_t dropped = 0;          ///< Frames dropped at the stage input because its queue was full.
+    uint32_t queue_depth = 0;      ///< Frames currently waiting in the input queue.
+    uint32_t max_queue_depth = 0;  ///< Highest queue depth seen.
+    int64_t mean_service_us = 0;   ///< Mean time the stage spends on a frame.
+    int64_t max_service_us = 0;    ///< Longest time the stage spent on a frame.
+};
+
+
+/**
+ * @brief Statistics of the frames the pipeline preallocates.
+ */
+struct FramePoolStats {
+    uint32_t frames = 0;      ///< Frames in the pool, each with its pixel and model input buffers.
+    uint32_t pixel_bytes = 0; ///< Capacity of every pixel buffer.
+    uint32_t free = 0;        ///< Frames neither in a stage nor held by a reader.
+    uint32_t waits = 0;       ///< Captures that found no free frame and waited for one.
+};
+
+
+/**
+ * @brief Continuous capture -> preprocess -> infer -> encode -> publish pipeline.
+ *
+ * Every stage is a FreeRTOS task connected to the next one by a bounded queue
+ * of CONFIG_PIPELINE_QUEUE_DEPTH frames, so the camera fills frame N+1 while
+ * frame N is preprocessed or inferred and frame N-1 is JPEG-encoded. The
+ * inference stage runs on CONFIG_CONTINUOUS_INFERENCE_CORE, the other stages
+ * on the other core next to the HTTP server. When a stage falls behind, its
+ * full queue drops the oldest or the newest frame (CONFIG_PIPELINE_DROP_POLICY)
+ * instead of stalling the camera.
+ *
+ * The last stage publishes every frame with publish_frame(), so HTTP handlers
+ * only read the latest published frame and never wait for inference. Frames
+ * come from the configured FrameSource, so the pipeline also runs in QEMU.
+ *
+ * start() allocates depth x stages + 1 frames with their pixel and model input
+ * buffers once. A frame goes back to a free queue when its last holder, a
+ * stage or a reader of the published frame, lets go.
+ */
+class InferencePipeline {
+public:
+    /// Pipeline stages, in processing order.
+    enum Stage { Capture, Preprocess, Infer, Encode, Publish, kNumStages };
+
+    InferencePipeline() = delete;
+
+    /**
+     * @brief Allocates the frame pool, creates the queues and starts the stage tasks.
+     *
+     * @param model The initialized model.
+     * @return ESP_OK on success, ESP_ERR_INVALID_STATE if already running,
+     *         ESP_ERR_NO_MEM or ESP_FAIL otherwise.
+     */
+    static esp_err_t start(TFLiteModel* model);
+
+    /**
+     * @brief Checks if the pipeline is running.
+     */
+    static bool is_running() { return running_; }
+
+    /**
+     * @brief Returns a snapshot of the statistics of a stage.
+     */
+    static StageStats stats(Stage stage);
+
+    /**
+     * @brief Returns a snapshot of the statistics of the frame pool.
+     */
+    static FramePoolStats pool_stats();
+
+    /**
+     * @brief Clears the statistics of all stages.
+     */
+    static void reset_stats();
+
+    /**
+     * @brief Logs the statistics of all stages and of the motion gate.
+     */
+    static void log_stats();
+
+private:
+    static inline bool running_ = false; ///< Whether start() succeeded.
+};
+
+#endif // INFERENCE_H
@@ -0,0 +1,99 @@
+#pragma once
+#include "esp_camera.h"
+#include "esp_err.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/**
+ * @brief Fixed pool of preallocated JPEG output framebuffers.
+ *
+ * convert_grayscale_to_jpeg() encodes straight into a pooled buffer instead
+ * of letting frame2jpg() malloc a new one per frame, and CameraFbDeleter
+ * hands it back, so steady-state encoding does not touch the heap. Buffers
+ * are sized for the worst-case encode of the frame and live in PSRAM.
+ */
+class JpegPool {
+public:
+    /**
+     * @brief Pool and heap counters.
+     */
+    struct Stats {
+        uint32_t buffers;              ///< Buffers in the pool.
+        uint32_t buffer_size;          ///< Capacity of every buffer.
+        uint32_t in_use;               ///< Buffers currently handed out.
+        uint32_t peak_in_use;          ///< Most buffers handed out at once.
+        uint32_t acquired;             ///< Buffers handed out since boot.
+        uint32_t exhausted;            ///< Encodes that found no free buffer.
+        uint32_t overflows;            ///< Encodes that did not fit a buffer.
+        uint32_t fallback_allocations; ///< Encodes that fell back to a heap buffer.
+        uint32_t psram_free;           ///< Free PSRAM.
+        uint32_t psram_largest_block;  ///< Largest free PSRAM block.
+    };
+
+    /**
+     * @brief Gets the pool used by convert_grayscale_to_jpeg().
+     */
+    static JpegPool& getInstance();
+
+    /**
+     * @brief Returns the largest JPEG a grayscale frame can encode to.
+     *
+     * A baseline 8x8 block costs at most 64 coefficients of 16-bit Huffman
+     * code plus 10-bit magnitude (208 bytes), plus about 1 KB of headers.
+     */
+    static size_t worst_case_size(size_t width, size_t height) {
+        return (width + 7) / 8 * ((height + 7) / 8) * 208 + 1024;
+    }
+
+    /**
+     * @brief Allocates the buffers. Later calls are no-ops.
+     *
+     * @param count Number of buffers.
+     * @param buffer_size Capacity of every buffer.
+     * @return ESP_OK on success, ESP_ERR_NO_MEM if the buffers cannot be allocated.
+     */
+    esp_err_t init(size_t count, size_t buffer_size);
+
+    /**
+     * @brief Takes a free buffer.
+     *
+     * @return A framebuffer whose buf has buffer_size() bytes, or nullptr if none is free.
+     */
+    camera_fb_t* acquire();
+
+    /**
+     * @brief Gives a buffer back.
+     *
+     * @param fb The framebuffer.
+     * @return False if the framebuffer does not belong to the pool.
+     */
+    bool release(camera_fb_t* fb);
+
+    size_t buffer_size() const { return buffer_size_; } ///< Capacity of every buffer.
+
+    void count_overflow();  ///< Counts an encode that did not fit a buffer.
+    void count_fallback();  ///< Counts an encode into a heap buffer.
+
+    /**
+     * @brief Returns a snapshot of the counters.
+     */
+    Stats stats() const;
+
+    /**
+     * @brief Clears the event counters; peak_in_use restarts at the current use.
+     */
+    void reset_stats();
+
+private:
+    JpegPool() = default;
+
+    mutable std::mutex mutex_;          ///< Guards everything below.
+    std::vector<camera_fb_t> slots_;    ///< Framebuffer of every buffer.
+    std::vector<uint16_t> free_;        ///< Indices of free slots, used as a stack.
+    uint8_t* memory_ = nullptr;         ///< All buffers, in one PSRAM block.
+    size_t buffer_size_ = 0;            ///< Capacity of every buffer.
+    Stats stats_ = {};                  ///< Counters.
+};
@@ -0,0 +1,144 @@
+#pragma once
+#include "esp_timer.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Points a frame passes on its way from the sensor to an HTTP response.
+ */
+enum class TracePoint : uint8_t {
+    Capture,         ///< Sensor started the frame (driver timestamp).
+    Captured,        ///< Frame copied out of the framebuffer.
+    PreprocessStart, ///< Resize/normalization started.
+    PreprocessEnd,   ///< Resize/normalization finished.
+    InferStart,      ///< TFLiteModel::invoke() started.
+    InferEnd,        ///< TFLiteModel::invoke() finished.
+    EncodeStart,     ///< JPEG encoding started.
+    EncodeEnd,       ///< JPEG encoding finished.
+    Published,       ///< Frame published as the latest result.
+    Request,         ///< HTTP handler entered.
+    ResponseStart,   ///< Response body about to be sent.
+    ResponseEnd,     ///< Response body sent.
+    Count            ///< Number of trace points.
+};
+
+
+/**
+ * @brief Returns the snake_case name of a trace point.
+ */
+const char* trace_point_name(TracePoint point);
+
+
+/**
+ * @brief esp_timer timestamps of one frame at every TracePoint (0 if not reached).
+ */
+struct FrameTrace {
+    static constexpr int kPoints = static_cast<int>(TracePoint::Count); ///< Number of points.
+
+    uint32_t frame_id = 0;    ///< Sequence number of the frame.
+    int64_t at[kPoints] = {}; ///< Timestamps, indexed by TracePoint.
+
+    /**
+     * @brief Records the current time at a point.
+     */
+    void mark(TracePoint point) { at[static_cast<int>(point)] = esp_timer_get_time(); }
+
+    /**
+     * @brief Sets the time of a point.
+     */
+    void set(TracePoint point, int64_t time_us) { at[static_cast<int>(point)] = time_us; }
+
+    /**
+     * @brief Returns the time of a point (0 if not reached).
+     */
+    int64_t get(TracePoint point) const { return at[static_cast<int>(point)]; }
+};
+
+
+/**
+ * @brief Fixed-size ring of the most recent frame traces.
+ *
+ * push() is lock-free and safe from any number of tasks: every writer claims
+ * a slot with an atomic increment and marks it with a sequence number that
+ * readers check before and after copying, so a record overwritten while being
+ * read is skipped instead of returned torn.
+ */
+class LatencyTraceRing {
+public:
+    /**
+     * @brief A named span between two trace points, summarized by the ring.
+     */
+    struct Segment {
+        const char* name; ///< Segment name.
+        TracePoint from;  ///< Start point.
+        TracePoint to;    ///< End point.
+    };
+
+    /**
+     * @brief Percentiles of one segment over the records in the ring.
+     */
+    struct Summary {
+        const char* name; ///< Segment name.
+        uint32_t count;   ///< Records that reached both points.
+        int64_t p50_us;   ///< Median.
+        int64_t p90_us;   ///< 90th percentile.
+        int64_t p99_us;   ///< 99th percentile.
+        int64_t max_us;   ///< Maximum.
+    };
+
+    static const Segment kSegments[]; ///< Segments reported by summarize().
+    static const size_t kNumSegments; ///< Number of entries in kSegments.
+
+    /**
+     * @brief Allocates the ring in PSRAM.
+     *
+     * @param capacity Number of records kept.
+     */
+    explicit LatencyTraceRing(size_t capacity);
+    ~LatencyTraceRing();
+
+    LatencyTraceRing(const LatencyTraceRing&) = delete;
+    LatencyTraceRing& operator=(const LatencyTraceRing&) = delete;
+
+    /**
+     * @brief Adds a record, overwriting the oldest one when full.
+     */
+    void push(const FrameTrace& trace);
+
+    /**
+     * @brief Returns up to `count` of the most recent records, oldest first.
+     */
+    std::vector<FrameTrace> last(size_t count) const;
+
+    /**
+     * @brief Computes the percentiles of every segment over the records in the ring.
+     */
+    std::vector<Summary> summarize() const;
+
+    size_t capacity() const { return capacity_; } ///< Number of records kept.
+    uint32_t pushed() const { return head_.load(std::memory_order_relaxed); } ///< Records pushed since boot.
+
+private:
+    /**
+     * @brief A ring slot. seq is 2 * index + 1 while being written, 2 * index + 2 when complete.
+     */
+    struct Slot {
+        std::atomic<uint32_t> seq;
+        FrameTrace trace;
+    };
+
+    Slot* slots_;                     ///< The ring, in PSRAM.
+    size_t capacity_;                 ///< Number of slots.
+    std::atomic<uint32_t> head_ = {0}; ///< Index of the next record.
+};
+
+
+/**
+ * @brief Returns the ring of /capture latency traces.
+ *
+ * @return The ring, or nullptr if CONFIG_LATENCY_TRACE is disabled.
+ */
+LatencyTraceRing* latency_traces();
@@ -0,0 +1,86 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+/**
+ * @brief Coarse summary of a grayscale frame: the mean of every cell of a kGrid x kGrid grid.
+ */
+struct MotionSignature {
+    static constexpr int kGrid = 16; ///< Cells per row and column (6x6 pixels for 96x96 frames).
+
+    uint8_t cells[kGrid * kGrid]; ///< Mean brightness of every cell, row-major.
+
+    /**
+     * @brief Computes the signature of a grayscale frame.
+     *
+     * @param pixels The grayscale frame.
+     * @param width The frame width (at least kGrid).
+     * @param height The frame height (at least kGrid).
+     */
+    void compute(const uint8_t* pixels, size_t width, size_t height);
+};
+
+
+/**
+ * @brief Frame-difference gate that decides when the model can be skipped.
+ *
+ * A frame is unchanged when the mean absolute difference between its
+ * signature and the signature of the last frame the model ran on is below
+ * the threshold. Comparing against the last inferred frame rather than the
+ * previous one keeps slow drifts from accumulating unnoticed, and after
+ * `max_skip` consecutive skips the model runs anyway.
+ */
+class MotionGate {
+public:
+    /**
+     * @brief Skip and execution counters.
+     */
+    struct Stats {
+        uint32_t executed;        ///< Frames the model ran on.
+        uint32_t skipped;         ///< Frames that reused the previous prediction.
+        uint32_t last_difference; ///< Mean absolute cell difference of the last checked frame.
+    };
+
+    /**
+     * @brief Constructs the gate.
+     *
+     * @param threshold Mean absolute cell difference (grey levels) below which a frame is unchanged.
+     * @param max_skip Maximum number of consecutive skipped frames (0 for no limit).
+     */
+    MotionGate(uint32_t threshold, uint32_t max_skip) : threshold_(threshold), max_skip_(max_skip) {}
+
+    /**
+     * @brief Checks whether a frame is unchanged and counts it as skipped if so.
+     *
+     * @param signature The signature of the frame.
+     * @return True if the previous prediction can be reused.
+     */
+    bool unchanged(const MotionSignature& signature);
+
+    /**
+     * @brief Records a frame the model ran on as the new reference.
+     *
+     * @param signature The signature of the frame.
+     */
+    void set_reference(const MotionSignature& signature);
+
+    /**
+     * @brief Returns a snapshot of the counters.
+     */
+    Stats stats() const;
+
+    /**
+     * @brief Clears the counters (the reference is kept).
+     */
+    void reset_stats();
+
+private:
+    const uint32_t threshold_;     ///< See the constructor.
+    const uint32_t max_skip_;      ///< See the constructor.
+    mutable std::mutex mutex_;     ///< Guards everything below.
+    MotionSignature reference_;    ///< Signature of the last inferred frame.
+    bool has_reference_ = false;   ///< Whether reference_ is valid.
+    uint32_t consecutive_skips_ = 0; ///< Skips since the last set_reference().
+    Stats stats_ = {};             ///< Counters.
+};
@@ -0,0 +1,109 @@
+#pragma once
+#include "tensorflow/lite/micro/micro_profiler_interface.h"
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/**
+ * @brief Per-operator cycle profiler for the TFLite Micro interpreter.
+ *
+ * The interpreter opens one event per executed operator. Events are keyed by
+ * their position in the graph, so two CONV_2D nodes are reported separately.
+ * Only every `sample_every`-th invocation is recorded; the others cost one
+ * branch per operator. Cycle counters are per core, so samples taken by a
+ * task that migrated between begin and end are dropped.
+ */
+class OpProfiler : public tflite::MicroProfilerInterface {
+public:
+    /**
+     * @brief Aggregated timings of one graph node (or of the whole invocation).
+     */
+    struct OpStats {
+        const char* tag;     ///< Operator name reported by the interpreter.
+        uint32_t count;      ///< Number of recorded executions.
+        uint32_t min_cycles; ///< Fastest execution.
+        uint32_t mean_cycles; ///< Mean over all recorded executions.
+        uint32_t p99_cycles; ///< 99th percentile over the last kSamples executions.
+        uint32_t max_cycles; ///< Slowest execution.
+    };
+
+    /**
+     * @brief Constructs the profiler.
+     *
+     * @param sample_every Record one invocation out of this many (1 records all).
+     */
+    explicit OpProfiler(uint32_t sample_every = 1) : sample_every_(sample_every ? sample_every : 1) {}
+
+    /**
+     * @brief Marks the start of an interpreter invocation and decides whether to sample it.
+     */
+    void begin_invoke();
+
+    /**
+     * @brief Marks the end of an interpreter invocation.
+     */
+    void end_invoke();
+
+    uint32_t BeginEvent(const char* tag) override;
+    void EndEvent(uint32_t event_handle) override;
+
+    /**
+     * @brief Returns the per-node statistics in graph order.
+     */
+    std::vector<OpStats> ops() const;
+
+    /**
+     * @brief Returns the statistics of whole invocations.
+     */
+    OpStats total() const;
+
+    uint32_t invocations() const { return invocations_; } ///< Number of invocations seen.
+
+    /**
+     * @brief Converts a cycle count to microseconds at the configured CPU frequency.
+     */
+    static float cycles_to_us(uint32_t cycles);
+
+    /**
+     * @brief Logs the per-node table.
+     */
+    void log_report() const;
+
+    /**
+     * @brief Clears all recorded statistics.
+     */
+    void reset();
+
+private:
+    static inline const char* TAG = "profiler"; ///< Tag for logging.
+    static constexpr int kMaxOps = 16;   ///< Maximum number of graph nodes tracked.
+    static constexpr int kSamples = 64;  ///< Recent samples kept per node for the p99.
+    static constexpr uint32_t kNotSampled = UINT32_MAX; ///< Handle of an ignored event.
+
+    struct Node {
+        const char* tag = nullptr;
+        uint32_t count = 0;
+        uint32_t min = UINT32_MAX;
+        uint32_t max = 0;
+        uint64_t sum = 0;
+        uint32_t samples[kSamples] = {};
+
+        void add(uint32_t cycles);
+        OpStats stats() const;
+    };
+
+    const uint32_t sample_every_;
+    uint32_t invocations_ = 0;
+    bool sampling_ = false;
+    int next_node_ = 0;
+    uint32_t invoke_start_ = 0;
+    int invoke_core_ = 0;
+    uint32_t event_start_[kMaxOps] = {};
+    int event_core_[kMaxOps] = {};
+
+    mutable std::mutex mutex_;
+    Node nodes_[kMaxOps];
+    int num_nodes_ = 0;
+    Node total_;
+};
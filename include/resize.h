@@ -0,0 +1,212 @@
+#ifndef RESIZE_H
+#define RESIZE_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * @brief Downscaling method used by ResizePlan.
+ */
+enum class ResizeMode {
+    Nearest, ///< Picks one source pixel per output pixel (matches the original float loop).
+    Box,     ///< Averages the source area covered by each output pixel (anti-aliased).
+};
+
+/**
+ * @brief Precomputed source-coordinate tables for one (src, dst, mode) geometry.
+ *
+ * Building a plan does all the float and division work once. Running it only
+ * uses table lookups, integer adds and a multiply-shift per output pixel.
+ * Plans are cached, so repeated calls with the same geometry are free. When the
+ * source already has the destination size the plan only maps pixels through the table.
+ */
+class ResizePlan {
+public:
+    /**
+     * @brief Returns the cached plan for the given geometry, building it on first use.
+     *
+     * @param src_w The width of the source image.
+     * @param src_h The height of the source image.
+     * @param dst_w The width of the destination image.
+     * @param dst_h The height of the destination image.
+     * @param mode The downscaling method.
+     * @return Shared pointer to the plan, or nullptr if any dimension is not positive.
+     */
+    static std::shared_ptr<const ResizePlan> get(int src_w, int src_h, int dst_w, int dst_h,
+                                                 ResizeMode mode);
+
+    /**
+     * @brief Resizes a grayscale image and maps every resulting sample through a lookup table.
+     *
+     * @tparam T The destination element type.
+     * @param src The source image buffer (src_w * src_h bytes).
+     * @param[out] dst The destination buffer (dst_w * dst_h elements).
+     * @param lut 256-entry table mapping a resized 8-bit sample to the output value.
+     */
+    template <typename T>
+    void run(const uint8_t *src, T *dst, const T *lut) const;
+
+    /**
+     * @brief Computes one output row from the source rows it covers.
+     *
+     * Lets a source that arrives row by row be resized without holding it
+     * whole (see ResizeStream); run() produces the same output.
+     *
+     * @tparam T The destination element type.
+     * @param y The output row.
+     * @param rows Source rows row_begin(y) .. row_begin(y) + row_count(y) - 1, src_w bytes each.
+     * @param[out] dst The output row (dst_w elements).
+     * @param lut 256-entry table mapping a resized 8-bit sample to the output value.
+     */
+    template <typename T>
+    void run_row(int y, const uint8_t *rows, T *dst, const T *lut) const;
+
+    /**
+     * @brief Returns the first source row read for output row y.
+     */
+    int row_begin(int y) const { return identity_ ? y : y_offset_[y] / src_w_; }
+
+    /**
+     * @brief Returns the number of source rows read for output row y.
+     */
+    int row_count(int y) const { return mode_ == ResizeMode::Box && !identity_ ? y_count_[y] : 1; }
+
+    int src_w() const { return src_w_; }
+    int src_h() const { return src_h_; }
+    int dst_w() const { return dst_w_; }
+    int dst_h() const { return dst_h_; }
+    ResizeMode mode() const { return mode_; }
+
+private:
+    ResizePlan(int src_w, int src_h, int dst_w, int dst_h, ResizeMode mode);
+
+    static constexpr int kRecipShift = 24; ///< Fixed-point precision of the box reciprocals.
+    static constexpr int kMaxRecipArea = 255; ///< Largest box area averaged with a reciprocal.
+    static constexpr int kCacheSize = 4;   ///< Number of geometries kept in the plan cache.
+
+    int src_w_, src_h_, dst_w_, dst_h_;
+    ResizeMode mode_;
+    bool identity_; ///< Source and destination have the same size, no tables are built.
+
+    std::vector<uint16_t> x_start_; ///< First source column for each output column.
+    std::vector<uint16_t> x_count_; ///< Number of source columns (box mode only).
+    std::vector<uint32_t> y_offset_; ///< Offset of the first source row for each output row.
+    std::vector<uint16_t> y_count_; ///< Number of source rows (box mode only).
+    std::vector<uint32_t> recip_;   ///< Q24 reciprocal of every box area (box mode with areas up to kMaxRecipArea only).
+};
+
+
+template <typename T>
+void ResizePlan::run(const uint8_t *src, T *dst, const T *lut) const {
+    if (identity_) {
+        // The frame already has the model input size: only map the pixels
+        for (int i = 0; i < dst_w_ * dst_h_; i++) {
+            dst[i] = lut[src[i]];
+        }
+        return;
+    }
+
+    for (int y = 0; y < dst_h_; y++, dst += dst_w_) {
+        run_row(y, src + y_offset_[y], dst, lut);
+    }
+}
+
+
+template <typename T>
+void ResizePlan::run_row(int y, const uint8_t *rows, T *dst, const T *lut) const {
+    if (identity_) {
+        for (int x = 0; x < dst_w_; x++) {
+            dst[x] = lut[rows[x]];
+        }
+        return;
+    }
+
+    if (mode_ == ResizeMode::Nearest) {
+        for (int x = 0; x < dst_w_; x++) {
+            dst[x] = lut[rows[x_start_[x]]];
+        }
+        return;
+    }
+
+    const int rows_n = y_count_[y];
+    for (int x = 0; x < dst_w_; x++) {
+        const uint8_t *p = rows + x_start_[x];
+        const int cols_n = x_count_[x];
+        const uint32_t area = rows_n * cols_n;
+
+        uint32_t sum = area / 2; // round to nearest
+        for (int r = 0; r < rows_n; r++, p += src_w_) {
+            for (int c = 0; c < cols_n; c++) {
+                sum += p[c];
+            }
+        }
+        // Larger areas would overflow the product and lose exact rounding, but
+        // also sum so many pixels that the division does not matter
+        dst[x] = lut[recip_.empty() ? sum / area : (sum * recip_[area]) >> kRecipShift];
+    }
+}
+
+
+/**
+ * @brief Resizes a grayscale image that arrives in arbitrary chunks of bytes.
+ *
+ * Keeps only the source rows the current output row needs, so memory depends
+ * on the source width and the vertical reduction, not on the image size. The
+ * 8-bit result is the same as ResizePlan::run() with an identity table.
+ */
+class ResizeStream {
+public:
+    /**
+     * @param plan The geometry, e.g. from ResizePlan::get().
+     * @param[out] dst The destination image (dst_w * dst_h bytes), filled as rows arrive.
+     */
+    ResizeStream(std::shared_ptr<const ResizePlan> plan, uint8_t *dst);
+
+    /**
+     * @brief Feeds the next bytes of the source image, row-major.
+     *
+     * Bytes past the end of the image are ignored.
+     */
+    void push(const uint8_t *data, size_t len);
+
+    /**
+     * @brief Checks if every output row has been written.
+     */
+    bool done() const { return y_ == plan_->dst_h(); }
+
+    /**
+     * @brief Returns the size of the row window in bytes.
+     */
+    size_t window_size() const { return window_.size(); }
+
+private:
+    /**
+     * @brief Writes the output rows whose source rows are complete and drops the rows no longer needed.
+     */
+    void emit();
+
+    std::shared_ptr<const ResizePlan> plan_;
+    uint8_t *dst_;
+    std::vector<uint8_t> window_; ///< Source rows from row_begin(y_) on.
+    int y_ = 0;                   ///< Next output row.
+    int row_ = 0;                 ///< Source row being received.
+    int col_ = 0;                 ///< Bytes of row_ received.
+};
+
+/**
+ * @brief Normalizes a pixel value to [-1, 1].
+ *
+ * Matches `Normalize((0.5,), (0.5,))` after `ToTensor()` in scripts/train.py,
+ * which the model is trained and its int8 input calibrated on.
+ */
+inline float normalize_pixel(int value) {
+    return value / 127.5f - 1.0f;
+}
+
+/**
+ * @brief 256-entry table mapping a pixel value to its normalized float (see normalize_pixel()).
+ */
+const float *normalize_lut();
+
+#endif // RESIZE_H
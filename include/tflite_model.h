@@ -5,6 +5,32 @@
 // #include "tensorflow/lite/micro/micro_error_reporter.h"
 #include "tensorflow/lite/micro/micro_log.h"
 
+#include "gesture_cnn.h"
+#include "op_profiler.h"
+#include "sdkconfig.h"
+
+/**
+ * @brief Spatial layout of an image tensor.
+ */
+struct ImageGeometry {
+    int width = 0;             ///< Image width.
+    int height = 0;            ///< Image height.
+    int channels = 0;          ///< Number of channels.
+    bool channels_first = false; ///< True for NCHW, false for NHWC.
+};
+
+/**
+ * @brief Detects the layout of an image tensor from its dimensions.
+ *
+ * A 4-D tensor whose second dimension is 1 or 3 while its last one is not
+ * is treated as NCHW; anything else 4-D (or 3-D HWC) as NHWC.
+ *
+ * @param tensor The tensor to inspect.
+ * @param[out] geometry The detected geometry.
+ * @return True if the tensor looks like a single image.
+ */
+bool detect_image_geometry(const TfLiteTensor* tensor, ImageGeometry& geometry);
+
 /**
  * @brief A wrapper class for managing TensorFlow Lite Micro models.
  *
@@ -44,6 +70,13 @@ public:
      */
     TfLiteTensor* output() { return output_; }
 
+    /**
+     * @brief Returns the layout of the input tensor, detected at init().
+     *
+     * @return const ImageGeometry& The input geometry.
+     */
+    const ImageGeometry& input_geometry() const { return input_geometry_; }
+
     /**
      * @brief Invokes the TensorFlow Lite Micro interpreter to perform inference.
      *
@@ -51,6 +84,18 @@ public:
      */
     TfLiteStatus invoke();
 
+    /**
+     * @brief Copies the output scores into a float buffer.
+     *
+     * Float outputs are copied as they are; int8 and uint8 outputs are
+     * dequantized with the output tensor's scale and zero-point.
+     *
+     * @param[out] scores The destination buffer.
+     * @param max_count The capacity of the destination buffer.
+     * @return int The number of scores written, or -1 if the output type is not supported.
+     */
+    int output_scores(float* scores, int max_count) const;
+
     /**
      * @brief Checks if the model has been successfully initialized.
      *
@@ -58,6 +103,34 @@ public:
      */
     bool is_initialized() const { return initialized_; }
 
+    /**
+     * @brief Returns the size of the tensor arena in bytes.
+     *
+     * @return size_t The arena size (measured need plus margin), or 0 before init().
+     */
+    size_t arena_size() const { return tensor_arena_size_; }
+
+    /**
+     * @brief Checks whether the tensor arena was placed in internal DRAM.
+     *
+     * @return True for internal DRAM, false for PSRAM.
+     */
+    bool arena_in_internal_ram() const { return arena_internal_; }
+
+    /**
+     * @brief Checks whether invoke() runs the hand-specialized GestureCNN instead of the interpreter.
+     *
+     * @return True if the specialized backend is active.
+     */
+    bool uses_specialized_backend() const { return specialized_ != nullptr; }
+
+    /**
+     * @brief Returns the per-operator profiler attached to the interpreter.
+     *
+     * @return OpProfiler* The profiler, or nullptr if CONFIG_MODEL_PROFILER is disabled.
+     */
+    OpProfiler* profiler() { return profiler_.get(); }
+
     /**
      * @brief Sets the index of the last detected gesture.
      *
@@ -78,11 +151,47 @@ public:
     ~TFLiteModel();
 
 private:
+    /**
+     * @brief Allocates tensors in a large temporary arena and returns the bytes actually used.
+     *
+     * @param model The model to measure.
+     * @return size_t The used arena size, or 0 on failure.
+     */
+    size_t measure_arena(const tflite::Model* model);
+
+    /**
+     * @brief Allocates the tensor arena in internal DRAM, falling back to PSRAM.
+     *
+     * @param size The arena size in bytes.
+     * @return True if the arena was allocated.
+     */
+    bool allocate_arena(size_t size);
+
+    /**
+     * @brief Loads the specialized backend and checks it against the interpreter.
+     *
+     * On any mismatch the interpreter stays in use.
+     * @param model The model to take the weights from.
+     */
+    void init_specialized(const tflite::Model* model);
+
+    /**
+     * @brief Logs the operator count, number of layout transposes, input layout and arena usage.
+     *
+     * @param model The loaded model.
+     */
+    void log_graph(const tflite::Model* model) const;
+
     static inline const char* TAG = "model"; ///< Tag for logging.
+    static constexpr float kSpecializedTolerance = 1e-3f; ///< Max relative logit difference accepted from the specialized backend, as in host_test.
     int last_detected_index_ = -1; ///< Index of the last detected gesture.
 
-    static constexpr int kTensorArenaSize = 37 * 1024; ///< Size of the tensor arena in bytes.
-    uint8_t* tensor_arena_; ///< Pointer to the tensor arena memory.
+    static constexpr size_t kProbeArenaSize = 128 * 1024; ///< PSRAM arena used once to measure the real need.
+    static constexpr size_t kArenaMargin = 1024; ///< Extra bytes on top of the measured arena usage.
+    static constexpr size_t kInternalReserve = CONFIG_MODEL_ARENA_INTERNAL_RESERVE_KB * 1024; ///< Internal DRAM left free for Wi-Fi and httpd.
+    uint8_t* tensor_arena_ = nullptr; ///< Pointer to the tensor arena memory.
+    size_t tensor_arena_size_ = 0; ///< Size of the tensor arena in bytes.
+    bool arena_internal_ = false; ///< Whether the arena lives in internal DRAM.
 
     const unsigned char* model_data_; ///< Pointer to the raw model data.
     const unsigned int* model_size_; ///< Pointer to the size of the raw model data.
@@ -90,8 +199,11 @@ private:
     // tflite::MicroErrorReporter error_reporter_; ///< Error reporter for logging (currently commented out).
     tflite::MicroMutableOpResolver<9> op_resolver_; ///< Operator resolver for TensorFlow Lite Micro.
     std::unique_ptr<tflite::MicroInterpreter> interpreter_; ///< Unique pointer to the TensorFlow Lite Micro interpreter.
+    std::unique_ptr<OpProfiler> profiler_; ///< Per-operator profiler (nullptr when disabled).
+    std::unique_ptr<GestureCNN> specialized_; ///< Hand-specialized backend (nullptr when the interpreter runs).
     
     TfLiteTensor* input_; ///< Pointer to the input tensor.
     TfLiteTensor* output_; ///< Pointer to the output tensor.
+    ImageGeometry input_geometry_; ///< Layout of the input tensor.
     bool initialized_ = false; ///< Flag indicating whether the model has been initialized.
 };
\ No newline at end of file
@@ -2,9 +2,11 @@
 #define WEB_GUI_H
 
 #include "esp_http_server.h"
+#include "sdkconfig.h"
 
 extern const char* WEBPAGE_HTML; ///< HTML content for the main web page.
-extern const char* GESTURES[]; ///< Array of gesture names corresponding to model output classes.
+constexpr size_t NUM_GESTURES = 14; ///< Number of gesture classes the model outputs.
+extern const char* GESTURES[NUM_GESTURES]; ///< Array of gesture names corresponding to model output classes.
 
 /**
  * @brief HTTP request handler for the main page.
@@ -15,7 +17,10 @@ extern const char* GESTURES[]; ///< Array of gesture names corresponding to mode
 esp_err_t index_handler(httpd_req_t *req);
 
 /**
- * @brief Starts the web server.
+ * @brief Starts the web server, its HTTP workers and the /stream server.
+ *
+ * /capture, /predict, /profile and /events.json run on the HttpWorkers tasks, the
+ * other handlers on the server task.
  *
  * @param[out] server The HTTP server handle.
  * @param[in] model_ctx A pointer to the TFLiteModel to be used by handlers.
@@ -27,26 +32,204 @@ esp_err_t startServer(httpd_handle_t &server, void* model_ctx);
  * @brief HTTP request handler for capturing an image and performing gesture
  * recognition.
  *
- * This function is called when a GET request is made to the /capture URI. It
- * captures an image from the camera, preprocesses it, runs inference with the
- * TFLite model, and sends the resulting image (either the original or the
- * preprocessed one) back to the client as a JPEG.
+ * This function is called when a GET request is made to the /capture URI. With
+ * continuous inference running it takes the latest published frame; otherwise
+ * it captures an image from the camera, runs inference with the TFLite model
+ * and publishes the result, sharing that work with the requests arriving within
+ * CONFIG_CAPTURE_COALESCE_WINDOW_MS (see capture_shared()). The frame is sent back to the client as a JPEG:
+ * the pipeline's JPEG if it has one, otherwise encoded block by block straight
+ * into chunks of the response. `?encode=stream` or `?encode=buffer` force a
+ * streamed or a fully buffered encode, to compare both in /pipeline.
+ *
+ * The prediction made on that same frame comes with the image in headers:
+ * X-Frame-Id, X-Gesture, X-Confidence, X-Top-K (the three most likely
+ * gestures with their probabilities), X-Reused, X-Capture-Us and a
+ * Server-Timing header with the preprocess, inference and encode times and the
+ * frame's age, so one request per frame is enough.
  *
  * @param req The HTTP request.
  * @return ESP_OK on success, or ESP_FAIL on failure.
  */
 esp_err_t capture_handler(httpd_req_t *req);
 
+/**
+ * @brief HTTP request handler for the MJPEG stream.
+ *
+ * This function is called when a GET request is made to the /stream URI of
+ * the stream server (CONFIG_STREAM_PORT). It pushes the latest published frame
+ * as a multipart/x-mixed-replace JPEG part at most CONFIG_STREAM_FPS (or
+ * `?fps=`) times per second, with the frame id, gesture, confidence and
+ * capture time in per-part X- headers. Frames are never queued: slots missed
+ * while a slow client received the last part are skipped, and frames published
+ * in between are not sent. With the pipeline stopped, every part is a fresh
+ * capture and prediction.
+ *
+ * Only one viewer streams at a time: the stream runs on its own task until the
+ * client disconnects, and further requests meanwhile get 503 with Retry-After.
+ *
+ * @param req The HTTP request.
+ * @return ESP_OK once the stream task started, ESP_FAIL (closing the socket)
+ *         when the request was turned away.
+ */
+esp_err_t stream_handler(httpd_req_t *req);
+
+/**
+ * @brief HTTP request handler for the prediction event stream.
+ *
+ * This function is called when a GET request is made to the /events URI. It
+ * answers with the text/event-stream headers and hands the socket to a
+ * broadcaster task, which pushes a `prediction` event with the frame id,
+ * gesture, confidence and timestamps whenever the published prediction
+ * changes. At most CONFIG_SSE_MAX_CLIENTS clients are served; every client
+ * buffers at most one record, skips the records published while it is
+ * behind and is closed if it stops taking bytes for 5 s.
+ *
+ * @param req The HTTP request.
+ * @return ESP_OK on success, or an error if sending the headers failed.
+ */
+esp_err_t sse_handler(httpd_req_t *req);
+
 /**
  * @brief HTTP request handler for retrieving the detected gesture name.
  *
  * This function is called when a GET request is made to the /gesture_name URI.
- * It retrieves the name of the detected gesture from the TFLite model and
- * sends it back to the client as plain text.
+ * It reads the name of the gesture detected in the latest published frame and
+ * sends it back to the client as plain text ("none" before the first frame).
  *
  * @param req The HTTP request.
  * @return ESP_OK on success, or ESP_FAIL on failure.
  */
 esp_err_t gesture_name_handler(httpd_req_t *req);
 
+/**
+ * @brief HTTP request handler for the latest published prediction.
+ *
+ * This function is called when a GET request is made to the /prediction URI.
+ * It returns the frame id, gesture, confidence, scores and timestamps of the
+ * latest published frame as JSON.
+ *
+ * @param req The HTTP request.
+ * @return ESP_OK on success, or ESP_FAIL if nothing was published yet.
+ */
+esp_err_t prediction_handler(httpd_req_t *req);
+
+/**
+ * @brief HTTP request handler for predictions on uploaded images.
+ *
+ * This function is called when a POST request is made to the /predict URI. The
+ * body is a JPEG, a binary PGM (P5) or raw 8-bit grayscale pixels with
+ * `?width=&height=`. The image goes through the same preprocessing and model
+ * as camera frames, and the prediction comes back as JSON with the receive,
+ * decode, preprocess and inference times. PGM and raw images are resized to
+ * the model input row by row as they are received, so memory does not grow
+ * with the image; a JPEG is kept compressed (at most CONFIG_PREDICT_MAX_JPEG_SIZE
+ * KB) and decoded at the strongest reduction that still covers the model
+ * input. The result is not published.
+ *
+ * @param req The HTTP request.
+ * @return ESP_OK on success, or ESP_FAIL on failure.
+ */
+esp_err_t predict_handler(httpd_req_t *req);
+
+/**
+ * @brief HTTP request handler for the per-operator inference profile.
+ *
+ * This function is called when a GET request is made to the /profile URI. It
+ * returns the profiler's per-operator min/mean/p99 timings as JSON and dumps
+ * the same table to the log. `?reset=1` clears the statistics afterwards.
+ *
+ * @param req The HTTP request.
+ * @return ESP_OK on success, or ESP_FAIL on failure.
+ */
+esp_err_t profile_handler(httpd_req_t *req);
+
+/**
+ * @brief HTTP request handler for the inference pipeline statistics.
+ *
+ * This function is called when a GET request is made to the /pipeline URI. It
+ * returns the processed, failed and dropped frames, queue depths and service
+ * times of every pipeline stage (if running), the fresh-frame counters of the
+ * frame source, the motion gate's executed and skipped inferences and the JPEG
+ * buffer pool and PSRAM fragmentation counters, the time-to-first-byte,
+ * response time and output buffer size of /capture responses, the shared
+ * on-demand captures and the /stream
+ * and /events delivery counters as JSON.
+ * `?reset=1` clears the statistics afterwards.
+ *
+ * @param req The HTTP request.
+ * @return ESP_OK on success, or ESP_FAIL on failure.
+ */
+esp_err_t pipeline_handler(httpd_req_t *req);
+
+/**
+ * @brief HTTP request handler for the /capture latency traces.
+ *
+ * This function is called when a GET request is made to the /trace URI. It
+ * returns the last `?n=` (default 16) traces, with every stage boundary
+ * relative to the sensor timestamp, and p50/p90/p99/max of every segment over
+ * all traces in the ring as JSON.
+ *
+ * @param req The HTTP request.
+ * @return ESP_OK on success, or ESP_FAIL if tracing is disabled.
+ */
+esp_err_t trace_handler(httpd_req_t *req);
+
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+/**
+ * @brief Header of every binary message on /ws, little-endian.
+ *
+ * A message is this header, followed by `jpeg_len` bytes of JPEG if the
+ * client asked for images. The scores are the model's raw outputs.
+ */
+struct __attribute__((packed)) WsFrameHeader {
+    static constexpr uint8_t kVersion = 1;     ///< Value of version.
+    static constexpr uint8_t kReused = 1;      ///< Flag: the motion gate reused the last prediction.
+
+    uint8_t version;         ///< Layout version, kVersion.
+    uint8_t flags;           ///< kReused.
+    int8_t class_index;      ///< Index of the detected gesture, -1 if none.
+    uint8_t num_scores;      ///< Valid entries in scores.
+    uint32_t frame_id;       ///< Sequence number of the frame.
+    float confidence;        ///< Softmax probability of the detected gesture.
+    int64_t capture_us;      ///< esp_timer time of the capture.
+    uint32_t preprocess_us;  ///< Time spent preprocessing.
+    uint32_t inference_us;   ///< Time spent in the model.
+    uint32_t encode_us;      ///< Time spent encoding the JPEG.
+    uint32_t age_us;         ///< Age of the frame when the message was queued.
+    uint32_t jpeg_len;       ///< Bytes of JPEG following the header, 0 without image.
+    float scores[16];        ///< Model outputs.
+};
+static_assert(sizeof(WsFrameHeader) == 104, "WsFrameHeader is a wire format");
+
+/**
+ * @brief WebSocket handler for the binary frame and prediction channel.
+ *
+ * This function is called for the handshake and for every client message on
+ * the /ws URI. After the handshake, a sender task pushes a WsFrameHeader
+ * and, unless turned off, the JPEG for every new published frame, at most
+ * CONFIG_STREAM_FPS times per second. Text messages like
+ * `{"fps": 5, "jpeg": false}` change the rate (1-30) and turn the image on
+ * or off. A frame that comes due while the client's previous message is still
+ * being sent is skipped, so at most one message per client is in flight.
+ *
+ * @param req The HTTP request.
+ * @return ESP_OK on success, or an error to close the connection.
+ */
+esp_err_t ws_handler(httpd_req_t *req);
+#endif
+
+#ifdef CONFIG_EVENT_TRACE
+/**
+ * @brief HTTP request handler for the event trace.
+ *
+ * This function is called when a GET request is made to the /events.json URI.
+ * It streams the event ring (see event_trace.h) as Chrome trace JSON in
+ * chunks, with one process per core and one thread per task.
+ *
+ * @param req The HTTP request.
+ * @return ESP_OK on success, or an error if sending failed.
+ */
+esp_err_t events_handler(httpd_req_t *req);
+#endif
+
 #endif // WEB_GUI_H
\ No newline at end of file
@@ -1,11 +1,73 @@
 #include "camera.h"
+#include "resize.h"
+#include "tflite_model.h"
+#include "event_trace.h"
+#include "jpeg_pool.h"
 
 #include "esp_heap_caps.h"
+#include "jpeg_decoder.h"
 #include "esp_system.h"
+#include "esp_timer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <vector>
 
 static const char* TAG = "camera";
+static constexpr int kJpegQuality = 80;
+
+#ifdef CONFIG_RESIZE_MODE_BOX
+static constexpr ResizeMode kResizeMode = ResizeMode::Box;
+#else
+static constexpr ResizeMode kResizeMode = ResizeMode::Nearest;
+#endif
+
+framesize_t smallest_frame_size(int min_width, int min_height) {
+    for (int size = FRAMESIZE_96X96; size < FRAMESIZE_INVALID; size++) {
+        if (resolution[size].width >= min_width && resolution[size].height >= min_height) {
+            return (framesize_t)size;
+        }
+    }
+    return FRAMESIZE_INVALID;
+}
 
-esp_err_t initCamera() {
+
+/**
+ * @brief Logs the framebuffer size and the mean time esp_camera_fb_get() takes.
+ *
+ * @param frames Number of frames to time.
+ */
+static void log_capture_timing(int frames) {
+    int64_t total_us = 0;
+    size_t len = 0, width = 0, height = 0;
+    int captured = 0;
+
+    for (int i = 0; i < frames; i++) {
+        int64_t start = esp_timer_get_time();
+        camera_fb_t *fb = esp_camera_fb_get();
+        if (!fb) {
+            continue;
+        }
+        total_us += esp_timer_get_time() - start;
+        len = fb->len;
+        width = fb->width;
+        height = fb->height;
+        captured++;
+        esp_camera_fb_return(fb);
+    }
+
+    if (captured) {
+        ESP_LOGI(TAG, "Camera: %zux%zu frames, %zu bytes per framebuffer, %lld us per capture",
+                 width, height, len, total_us / captured);
+    }
+}
+
+
+esp_err_t initCamera(int min_width, int min_height) {
+    TRACE_FUNCTION();
     ESP_LOGI(TAG, "Camera: Initializing...");
 
     #ifdef CONFIG_ENABLE_QEMU_DEBUG
@@ -13,6 +75,19 @@ esp_err_t initCamera() {
         return ESP_OK;
     #endif
 
+#ifdef CONFIG_CAMERA_JPEG
+    // The model input comes from a reduced-scale decode, the frame must cover it after the reduction
+    min_width *= CONFIG_CAMERA_JPEG_DECODE_SCALE;
+    min_height *= CONFIG_CAMERA_JPEG_DECODE_SCALE;
+#endif
+
+    // The smallest frame covering the model input keeps DMA, PSRAM and resize work minimal
+    framesize_t frame_size = smallest_frame_size(min_width, min_height);
+    if (frame_size == FRAMESIZE_INVALID) {
+        ESP_LOGE(TAG, "Camera: No frame size covers %dx%d", min_width, min_height);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
     // Check if PSRAM is available
     size_t total_heap = esp_get_free_heap_size();
     ESP_LOGI(TAG,
@@ -39,12 +114,18 @@ esp_err_t initCamera() {
     config.pin_pwdn = PWDN_GPIO_NUM;
     config.pin_reset = RESET_GPIO_NUM;
     config.xclk_freq_hz = 20000000;
+#ifdef CONFIG_CAMERA_JPEG
+    config.pixel_format = PIXFORMAT_JPEG;
+    config.jpeg_quality = CONFIG_CAMERA_JPEG_QUALITY;
+#else
     config.pixel_format = PIXFORMAT_GRAYSCALE;
-    config.frame_size = FRAMESIZE_96X96;
-    config.fb_location = CAMERA_FB_IN_PSRAM;
-    config.grab_mode = CAMERA_GRAB_WHEN_EMPTY;
     config.jpeg_quality = 12;
-    config.fb_count = 1;
+#endif
+    config.frame_size = frame_size;
+    config.fb_location = CAMERA_FB_IN_PSRAM;
+    config.fb_count = CONFIG_CAMERA_FB_COUNT;
+    // With spare buffers the driver keeps capturing and hands out the newest frame
+    config.grab_mode = CONFIG_CAMERA_FB_COUNT > 1 ? CAMERA_GRAB_LATEST : CAMERA_GRAB_WHEN_EMPTY;
 
     if (esp_camera_init(&config) != ESP_OK) {
         ESP_LOGE(TAG, "Camera: Failed to initialize");
@@ -55,39 +136,280 @@ esp_err_t initCamera() {
     sensor_t *s = esp_camera_sensor_get();
     s->set_vflip(s, 1);
 
+    const int frame_pixels = resolution[frame_size].width * resolution[frame_size].height;
+    const int model_pixels = std::max(1, min_width * min_height);
+    ESP_LOGI(TAG, "Camera: %dx%d frames for a %dx%d model input (%.1fx the pixels)",
+             resolution[frame_size].width, resolution[frame_size].height, min_width, min_height,
+             (float)frame_pixels / model_pixels);
+    log_capture_timing(5);
+
     return ESP_OK;
 }
 
 
 void resize_and_normalize_grayscale(uint8_t *src, int src_w, int src_h,
                                    float *dst, int dst_w, int dst_h) {
-    float scale_x = (float)src_w / dst_w;
-    float scale_y = (float)src_h / dst_h;
-
-    for (int y = 0; y < dst_h; y++) {
-        for (int x = 0; x < dst_w; x++) {
-            int src_x = (int)(x * scale_x);
-            int src_y = (int)(y * scale_y);
-            uint8_t pixel = src[src_y * src_w + src_x];
-            dst[y * dst_w + x] = pixel / 255.0f; // Normalize to 0-1
+    TRACE_FUNCTION();
+    auto plan = ResizePlan::get(src_w, src_h, dst_w, dst_h, kResizeMode);
+    if (plan) {
+        plan->run(src, dst, normalize_lut());
+    }
+}
+
+
+/**
+ * @brief Returns a 256-entry table mapping a pixel value to its quantized normalized value.
+ *
+ * Every (scale, zero-point) gets its own table, built on first use and never
+ * changed or freed afterwards, so the pipeline and HTTP handlers can read
+ * tables concurrently while the lookup itself is locked.
+ */
+template <typename T>
+static const T *quantize_lut(float scale, int32_t zero_point) {
+    struct Table {
+        float scale;
+        int32_t zero_point;
+        T values[256];
+    };
+    static std::mutex mutex;
+    static std::vector<std::unique_ptr<Table>> tables; // one per model input in practice
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto &table : tables) {
+        if (table->scale == scale && table->zero_point == zero_point) {
+            return table->values;
+        }
+    }
+
+    auto table = std::make_unique<Table>();
+    table->scale = scale;
+    table->zero_point = zero_point;
+    for (int i = 0; i < 256; i++) {
+        int32_t q = (int32_t)lroundf(normalize_pixel(i) / scale) + zero_point;
+        table->values[i] = (T)std::clamp<int32_t>(q, std::numeric_limits<T>::min(),
+                                                  std::numeric_limits<T>::max());
+    }
+    tables.push_back(std::move(table));
+    return tables.back()->values;
+}
+
+
+esp_err_t preprocess_grayscale(const uint8_t *src, int src_w, int src_h,
+                               const TfLiteTensor *input, void *dst) {
+    TRACE_FUNCTION();
+    ImageGeometry geometry;
+    if (!detect_image_geometry(input, geometry) || geometry.channels != 1) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    // Integer inputs need the quantization parameters to map pixels into them
+    if ((input->type == kTfLiteInt8 || input->type == kTfLiteUInt8) && !(input->params.scale > 0.0f)) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    // With a single channel NCHW and NHWC share the same memory layout
+    auto plan = ResizePlan::get(src_w, src_h, geometry.width, geometry.height, kResizeMode);
+    if (!plan) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    switch (input->type) {
+        case kTfLiteFloat32:
+            plan->run(src, static_cast<float *>(dst), normalize_lut());
+            return ESP_OK;
+        case kTfLiteInt8:
+            plan->run(src, static_cast<int8_t *>(dst),
+                      quantize_lut<int8_t>(input->params.scale, input->params.zero_point));
+            return ESP_OK;
+        case kTfLiteUInt8:
+            plan->run(src, static_cast<uint8_t *>(dst),
+                      quantize_lut<uint8_t>(input->params.scale, input->params.zero_point));
+            return ESP_OK;
+        default:
+            return ESP_ERR_NOT_SUPPORTED;
+    }
+}
+
+
+std::shared_ptr<const ResizePlan> preprocess_resize_plan(int src_w, int src_h, const TfLiteTensor *input) {
+    ImageGeometry geometry;
+    if (!detect_image_geometry(input, geometry) || geometry.channels != 1) {
+        return nullptr;
+    }
+    return ResizePlan::get(src_w, src_h, geometry.width, geometry.height, kResizeMode);
+}
+
+
+esp_err_t preprocess_grayscale_to_tensor(const uint8_t *src, int src_w, int src_h,
+                                         TfLiteTensor *input) {
+    return preprocess_grayscale(src, src_w, src_h, input, input->data.raw);
+}
+
+
+void CameraFbDeleter::operator()(camera_fb_t* fb) const {
+    if (fb && !JpegPool::getInstance().release(fb)) {
+        if (fb->buf) {
+            free(fb->buf); // Use free for buffer allocated by frame2jpg
+        }
+        delete fb;
+    }
+}
+
+
+/**
+ * @brief Output of frame2jpg_cb() into a fixed buffer.
+ */
+struct JpegSink {
+    uint8_t* buf;    ///< The buffer.
+    size_t capacity; ///< Size of the buffer.
+    size_t len;      ///< Bytes written so far.
+    bool overflow;   ///< The image did not fit.
+};
+
+static size_t jpeg_sink_write(void* arg, size_t index, const void* data, size_t len) {
+    JpegSink* sink = (JpegSink*)arg;
+    if (index + len > sink->capacity) {
+        sink->overflow = true;
+        return 0; // aborts the encode
+    }
+    memcpy(sink->buf + index, data, len);
+    sink->len = index + len;
+    return len;
+}
+
+
+esp_err_t decode_jpeg_to_grayscale(const camera_fb_t *jpeg_fb, int scale, uint8_t *dst, size_t dst_size) {
+    TRACE_FUNCTION();
+    esp_jpeg_image_scale_t out_scale;
+    switch (scale) {
+        case 1: out_scale = JPEG_IMAGE_SCALE_0; break;
+        case 2: out_scale = JPEG_IMAGE_SCALE_1_2; break;
+        case 4: out_scale = JPEG_IMAGE_SCALE_1_4; break;
+        case 8: out_scale = JPEG_IMAGE_SCALE_1_8; break;
+        default: return ESP_ERR_INVALID_ARG;
+    }
+
+    size_t width, height;
+    decoded_jpeg_size(jpeg_fb, scale, width, height);
+    if (jpeg_fb->format != PIXFORMAT_JPEG) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (dst_size < width * height * 3) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    esp_jpeg_image_cfg_t config = {};
+    config.indata = jpeg_fb->buf;
+    config.indata_size = jpeg_fb->len;
+    config.outbuf = dst;
+    config.outbuf_size = dst_size;
+    config.out_format = JPEG_IMAGE_FORMAT_RGB888;
+    config.out_scale = out_scale;
+    esp_jpeg_image_output_t image = {};
+    esp_err_t err = esp_jpeg_decode(&config, &image);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    // BT.601 luma in place: pixel i is written after its RGB triplet at 3i was read
+    for (size_t i = 0; i < width * height; i++) {
+        const uint8_t *rgb = dst + 3 * i;
+        dst[i] = (77 * rgb[0] + 150 * rgb[1] + 29 * rgb[2]) >> 8;
+    }
+    return ESP_OK;
+}
+
+
+esp_err_t read_jpeg_size(const uint8_t *data, size_t len, size_t &width, size_t &height) {
+    esp_jpeg_image_cfg_t config = {};
+    config.indata = const_cast<uint8_t *>(data);
+    config.indata_size = len;
+    esp_jpeg_image_output_t image = {};
+    esp_err_t err = esp_jpeg_get_image_info(&config, &image);
+    if (err != ESP_OK) {
+        return err;
+    }
+    width = image.width;
+    height = image.height;
+    return ESP_OK;
+}
+
+
+std::unique_ptr<camera_fb_t, CameraFbDeleter> copy_jpeg(const camera_fb_t *jpeg_fb) {
+    // Sized for a software encode of the frame, far more than the sensor's JPEG needs
+    JpegPool& pool = JpegPool::getInstance();
+    pool.init(CONFIG_JPEG_POOL_BUFFERS, JpegPool::worst_case_size(jpeg_fb->width, jpeg_fb->height));
+
+    std::unique_ptr<camera_fb_t, CameraFbDeleter> copy(pool.acquire());
+    if (copy && jpeg_fb->len > pool.buffer_size()) {
+        pool.count_overflow();
+        copy.reset();
+    }
+    if (!copy) {
+        uint8_t *buf = (uint8_t *)malloc(jpeg_fb->len);
+        if (!buf) {
+            return nullptr;
         }
+        pool.count_fallback();
+        copy.reset(new camera_fb_t());
+        copy->buf = buf;
     }
+
+    memcpy(copy->buf, jpeg_fb->buf, jpeg_fb->len);
+    copy->len = jpeg_fb->len;
+    copy->width = jpeg_fb->width;
+    copy->height = jpeg_fb->height;
+    copy->format = PIXFORMAT_JPEG;
+    copy->timestamp = jpeg_fb->timestamp;
+    return copy;
+}
+
+
+bool encode_grayscale_jpeg(camera_fb_t *grayscale_fb, jpg_out_cb cb, void *arg) {
+    TRACE_FUNCTION();
+    if (grayscale_fb->format != PIXFORMAT_GRAYSCALE) {
+        return false;
+    }
+    return frame2jpg_cb(grayscale_fb, kJpegQuality, cb, arg);
 }
 
 
 std::unique_ptr<camera_fb_t, CameraFbDeleter> convert_grayscale_to_jpeg(camera_fb_t *grayscale_fb) {
+    TRACE_FUNCTION();
     if (grayscale_fb->format != PIXFORMAT_GRAYSCALE) {
         return nullptr;
     }
 
+    // The pool is sized on the first encode, every later frame has the same size
+    JpegPool& pool = JpegPool::getInstance();
+    pool.init(CONFIG_JPEG_POOL_BUFFERS,
+              JpegPool::worst_case_size(grayscale_fb->width, grayscale_fb->height));
+
+    std::unique_ptr<camera_fb_t, CameraFbDeleter> jpeg_fb(pool.acquire());
+    if (jpeg_fb) {
+        JpegSink sink = {jpeg_fb->buf, pool.buffer_size(), 0, false};
+        if (encode_grayscale_jpeg(grayscale_fb, jpeg_sink_write, &sink)) {
+            jpeg_fb->len = sink.len;
+            jpeg_fb->width = grayscale_fb->width;
+            jpeg_fb->height = grayscale_fb->height;
+            jpeg_fb->timestamp = grayscale_fb->timestamp;
+            return jpeg_fb;
+        }
+        jpeg_fb.reset();
+        if (sink.overflow) {
+            pool.count_overflow();
+        }
+    }
+
     size_t jpeg_size = 0;
     uint8_t *jpeg_buf = NULL;
 
-    bool jpeg_converted = frame2jpg(grayscale_fb, 80, &jpeg_buf, &jpeg_size);
+    bool jpeg_converted = frame2jpg(grayscale_fb, kJpegQuality, &jpeg_buf, &jpeg_size);
 
     if (jpeg_converted && jpeg_buf) {
+        pool.count_fallback();
         // Create new frame buffer with JPG photo
-        std::unique_ptr<camera_fb_t, CameraFbDeleter> jpeg_fb(new camera_fb_t); 
+        jpeg_fb.reset(new camera_fb_t());
         jpeg_fb->buf = jpeg_buf;
         jpeg_fb->len = jpeg_size;
         jpeg_fb->width = grayscale_fb->width;
@@ -97,4 +419,4 @@ std::unique_ptr<camera_fb_t, CameraFbDeleter> convert_grayscale_to_jpeg(camera_f
     }
 
     return nullptr;
-}
\ No newline at end of file
+}
@@ -0,0 +1,77 @@
+#include "event_trace.h"
+
+#ifdef CONFIG_EVENT_TRACE
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include <cstring>
+#include <new>
+
+static const char* TAG = "event_trace";
+
+
+esp_err_t EventTrace::init(size_t capacity) {
+    if (slots_) {
+        return ESP_OK;
+    }
+
+    Slot* slots = static_cast<Slot*>(heap_caps_malloc(capacity * sizeof(Slot), MALLOC_CAP_SPIRAM));
+    if (!slots) {
+        ESP_LOGE(TAG, "Cannot allocate %u events", (unsigned)capacity);
+        return ESP_ERR_NO_MEM;
+    }
+    for (size_t i = 0; i < capacity; i++) {
+        new (&slots[i]) Slot();
+        slots[i].seq.store(0, std::memory_order_relaxed);
+    }
+
+    capacity_ = capacity;
+    slots_ = slots;
+    ESP_LOGI(TAG, "Tracing %u events (%u bytes of PSRAM)", (unsigned)capacity,
+             (unsigned)(capacity * sizeof(Slot)));
+    return ESP_OK;
+}
+
+
+void EventTrace::record(const char* name, int64_t start_us, int64_t end_us) {
+    if (!slots_) {
+        return;
+    }
+
+    const uint32_t index = head_.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = slots_[index % capacity_];
+    slot.seq.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    Event& event = slot.event;
+    event.name = name;
+    event.start_us = start_us;
+    event.duration_us = end_us - start_us;
+    event.task_id = (uint32_t)(uintptr_t)task;
+    event.core = xPortGetCoreID();
+    strncpy(event.task_name, pcTaskGetName(task), kTaskNameLen - 1);
+    event.task_name[kTaskNameLen - 1] = '\0';
+
+    slot.seq.store(2 * index + 2, std::memory_order_release);
+}
+
+
+bool EventTrace::read(uint32_t index, Event& event) {
+    if (!slots_) {
+        return false;
+    }
+
+    const Slot& slot = slots_[index % capacity_];
+    if (slot.seq.load(std::memory_order_acquire) != 2 * index + 2) {
+        return false;
+    }
+    event = slot.event;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot.seq.load(std::memory_order_relaxed) == 2 * index + 2;
+}
+
+#endif // CONFIG_EVENT_TRACE
@@ -0,0 +1,279 @@
+#include "frame_source.h"
+#include "camera.h"
+#include "event_trace.h"
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#include <algorithm>
+#include <condition_variable>
+
+static const char* TAG = "frame_source";
+
+
+/**
+ * @brief Frames from the camera driver.
+ */
+class CameraFrameSource : public FrameSource {
+public:
+    camera_fb_t* fb_get() override { return esp_camera_fb_get(); }
+    void fb_return(camera_fb_t* fb) override { esp_camera_fb_return(fb); }
+    const char* name() const override { return "camera"; }
+
+protected:
+    esp_err_t init(int min_width, int min_height) override { return initCamera(min_width, min_height); }
+};
+
+
+/**
+ * @brief Base of the sources that produce frames in software.
+ *
+ * Frames are paced to CONFIG_FRAME_SOURCE_FPS (0 for as fast as requested)
+ * and timestamped like the camera driver does. Like the driver's
+ * CONFIG_CAMERA_FB_COUNT buffers, every frame handed out has its own slot
+ * until fb_return(), and fb_get() waits while all slots are taken, so
+ * concurrent callers never see a frame being overwritten.
+ */
+class SyntheticFrameSource : public FrameSource {
+public:
+    static constexpr size_t kFrames = CONFIG_CAMERA_FB_COUNT; ///< Frames that can be out at once.
+
+    camera_fb_t* fb_get() override {
+        size_t slot;
+        {
+            std::unique_lock<std::mutex> lock(slots_mutex_);
+            slots_cv_.wait(lock, [this] { return std::find(in_use_, in_use_ + kFrames, false) != in_use_ + kFrames; });
+            slot = std::find(in_use_, in_use_ + kFrames, false) - in_use_;
+            in_use_[slot] = true;
+        }
+
+        uint32_t index;
+        {
+            std::lock_guard<std::mutex> lock(pace_mutex_);
+#if CONFIG_FRAME_SOURCE_FPS > 0
+            if (!last_wake_) {
+                last_wake_ = xTaskGetTickCount();
+            }
+            vTaskDelayUntil(&last_wake_, std::max<TickType_t>(1, pdMS_TO_TICKS(1000 / CONFIG_FRAME_SOURCE_FPS)));
+#endif
+            index = frame_index_++;
+        }
+
+        camera_fb_t& fb = frames_[slot];
+        if (!fill(fb, index, slot)) {
+            fb_return(&fb);
+            return nullptr;
+        }
+        int64_t now = esp_timer_get_time();
+        fb.timestamp.tv_sec = now / 1000000;
+        fb.timestamp.tv_usec = now % 1000000;
+        fb.format = PIXFORMAT_GRAYSCALE;
+        return &fb;
+    }
+
+    void fb_return(camera_fb_t* fb) override {
+        {
+            std::lock_guard<std::mutex> lock(slots_mutex_);
+            in_use_[fb - frames_] = false;
+        }
+        slots_cv_.notify_one();
+    }
+
+protected:
+    /**
+     * @brief Fills buf, len, width and height of a frame.
+     *
+     * @param fb The frame to fill.
+     * @param index The index of the frame since start-up.
+     * @param slot The slot of the frame, below kFrames; no other caller uses it until the frame is returned.
+     * @return False on failure.
+     */
+    virtual bool fill(camera_fb_t& fb, uint32_t index, size_t slot) = 0;
+
+private:
+    camera_fb_t frames_[kFrames] = {}; ///< The frames handed out by fb_get().
+    bool in_use_[kFrames] = {};        ///< Which frames are out.
+    std::mutex slots_mutex_;           ///< Guards in_use_.
+    std::condition_variable slots_cv_; ///< Notified when a frame is returned.
+    std::mutex pace_mutex_;            ///< Guards frame_index_ and last_wake_.
+    uint32_t frame_index_ = 0;         ///< Index of the next frame.
+    TickType_t last_wake_ = 0;         ///< Pacing reference.
+};
+
+
+#ifdef CONFIG_FRAME_SOURCE_PATTERN
+/**
+ * @brief Deterministic test pattern: a bright square moving over a diagonal gradient.
+ *
+ * The square moves every CONFIG_FRAME_SOURCE_PATTERN_HOLD frames, so longer
+ * holds exercise the motion gate.
+ */
+class PatternFrameSource : public SyntheticFrameSource {
+public:
+    static constexpr size_t kWidth = 96;  ///< Width of FRAMESIZE_96X96.
+    static constexpr size_t kHeight = 96; ///< Height of FRAMESIZE_96X96.
+    static constexpr size_t kSquare = 24; ///< Side of the moving square.
+
+    ~PatternFrameSource() override {
+        for (uint8_t* pixels : pixels_) {
+            heap_caps_free(pixels);
+        }
+    }
+
+    const char* name() const override { return "pattern"; }
+
+protected:
+    esp_err_t init(int min_width, int min_height) override {
+        for (uint8_t*& pixels : pixels_) {
+            pixels = (uint8_t*)heap_caps_malloc(kWidth * kHeight, MALLOC_CAP_SPIRAM);
+            if (!pixels) {
+                return ESP_ERR_NO_MEM;
+            }
+        }
+        return ESP_OK;
+    }
+
+    bool fill(camera_fb_t& fb, uint32_t index, size_t slot) override {
+        uint8_t* pixels = pixels_[slot];
+        const uint32_t step = index / CONFIG_FRAME_SOURCE_PATTERN_HOLD;
+        const size_t square_x = triangle(step * 3, kWidth - kSquare);
+        const size_t square_y = triangle(step * 2, kHeight - kSquare);
+
+        for (size_t y = 0; y < kHeight; y++) {
+            uint8_t* row = pixels + y * kWidth;
+            const bool in_rows = y >= square_y && y < square_y + kSquare;
+            for (size_t x = 0; x < kWidth; x++) {
+                const bool in_square = in_rows && x >= square_x && x < square_x + kSquare;
+                row[x] = in_square ? 240 : (x + y) * 160 / (kWidth + kHeight);
+            }
+        }
+
+        fb.buf = pixels;
+        fb.len = kWidth * kHeight;
+        fb.width = kWidth;
+        fb.height = kHeight;
+        return true;
+    }
+
+private:
+    /**
+     * @brief Bounces a position between 0 and max.
+     */
+    static size_t triangle(uint32_t t, size_t max) {
+        const uint32_t period = 2 * max;
+        const uint32_t phase = t % period;
+        return phase <= max ? phase : period - phase;
+    }
+
+    uint8_t* pixels_[kFrames] = {}; ///< The pattern of every slot, rendered in place.
+};
+#endif
+
+
+#ifdef CONFIG_FRAME_SOURCE_REPLAY
+/**
+ * @brief Replays the frames embedded from CONFIG_FRAME_SOURCE_REPLAY_DIR in a loop.
+ */
+class ReplayFrameSource : public SyntheticFrameSource {
+public:
+    const char* name() const override { return "replay"; }
+
+protected:
+    esp_err_t init(int min_width, int min_height) override {
+        if (replay_frames_count == 0) {
+            ESP_LOGE(TAG, "No frames embedded for replay");
+            return ESP_ERR_NOT_FOUND;
+        }
+        ESP_LOGI(TAG, "Replaying %u frames", (unsigned)replay_frames_count);
+        return ESP_OK;
+    }
+
+    bool fill(camera_fb_t& fb, uint32_t index, size_t slot) override {
+        const ReplayFrame& frame = replay_frames[index % replay_frames_count];
+        // Consumers never write to frames, so they can point into flash
+        fb.buf = const_cast<uint8_t*>(frame.pixels);
+        fb.len = frame.width * frame.height;
+        fb.width = frame.width;
+        fb.height = frame.height;
+        return true;
+    }
+};
+#endif
+
+
+camera_fb_t* FrameSource::fb_get_fresh(int64_t not_before_us) {
+    TRACE_FUNCTION();
+    // Every buffer can hold at most one stale frame, plus the one being filled
+    const int max_flushes = CONFIG_CAMERA_FB_COUNT + 1;
+
+    int64_t start = esp_timer_get_time();
+    int64_t first_flush = 0;
+    uint32_t flushes = 0;
+    camera_fb_t* fb = fb_get();
+    while (fb && timestamp_us(fb) < not_before_us && flushes < max_flushes) {
+        if (!first_flush) {
+            first_flush = esp_timer_get_time();
+        }
+        fb_return(fb);
+        flushes++;
+        fb = fb_get();
+    }
+
+    int64_t end = esp_timer_get_time();
+    if (fb && timestamp_us(fb) < not_before_us) {
+        ESP_LOGW(TAG, "No fresh frame after %lu flushes", (unsigned long)flushes);
+    }
+
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.fresh_requests++;
+    stats_.stale_flushes += flushes;
+    total_wait_us_ += end - start;
+    stats_.max_wait_us = std::max(stats_.max_wait_us, end - start);
+    stats_.flush_wait_us += first_flush ? end - first_flush : 0;
+    return fb;
+}
+
+
+FrameSource::Stats FrameSource::stats() const {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    Stats stats = stats_;
+    stats.mean_wait_us = stats_.fresh_requests ? total_wait_us_ / stats_.fresh_requests : 0;
+    return stats;
+}
+
+
+void FrameSource::reset_stats() {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_ = {};
+    total_wait_us_ = 0;
+}
+
+
+esp_err_t FrameSource::initialize(int min_width, int min_height) {
+    if (instance) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+#if defined(CONFIG_FRAME_SOURCE_PATTERN)
+    FrameSource* source = new PatternFrameSource();
+#elif defined(CONFIG_FRAME_SOURCE_REPLAY)
+    FrameSource* source = new ReplayFrameSource();
+#else
+    FrameSource* source = new CameraFrameSource();
+#endif
+
+    esp_err_t err = source->init(min_width, min_height);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Cannot initialize %s source: %s", source->name(), esp_err_to_name(err));
+        delete source;
+        return err;
+    }
+
+    ESP_LOGI(TAG, "Frame source: %s", source->name());
+    instance = source;
+    return ESP_OK;
+}
@@ -0,0 +1,220 @@
+#include "gesture_cnn.h"
+
+#include "esp_log.h"
+#include "tensorflow/lite/schema/schema_utils.h"
+
+#include <algorithm>
+#include <cstring>
+#include <initializer_list>
+
+/**
+ * @brief Fused 3x3 VALID convolution + bias + ReLU + 2x2 max pooling.
+ *
+ * Only the convolution outputs that survive pooling are computed. The input
+ * and the filter ([out][ky][kx][in]) are channel-innermost.
+ *
+ * @tparam IN_H Input height.
+ * @tparam IN_W Input width.
+ * @tparam IN_C Input channels.
+ * @tparam OUT_C Output channels.
+ * @tparam OUT_CHW Write the output channel-major (CHW) instead of HWC.
+ */
+template <int IN_H, int IN_W, int IN_C, int OUT_C, bool OUT_CHW>
+static void conv3x3_relu_maxpool2(const float* in, const float* w, const float* b, float* out) {
+    constexpr int OUT_H = (IN_H - 2) / 2;
+    constexpr int OUT_W = (IN_W - 2) / 2;
+
+    for (int oy = 0; oy < OUT_H; oy++) {
+        for (int ox = 0; ox < OUT_W; ox++) {
+            for (int oc = 0; oc < OUT_C; oc++) {
+                const float* filter = w + oc * 3 * 3 * IN_C;
+                float best = 0.0f; // ReLU(max(x)) == max(0, x...)
+
+                for (int py = 0; py < 2; py++) {
+                    for (int px = 0; px < 2; px++) {
+                        const int y = oy * 2 + py;
+                        const int x = ox * 2 + px;
+                        float acc = b[oc];
+                        for (int ky = 0; ky < 3; ky++) {
+                            const float* row = in + ((y + ky) * IN_W + x) * IN_C;
+                            const float* wrow = filter + ky * 3 * IN_C;
+                            for (int k = 0; k < 3 * IN_C; k++) {
+                                acc += row[k] * wrow[k];
+                            }
+                        }
+                        best = std::max(best, acc);
+                    }
+                }
+
+                if (OUT_CHW) {
+                    out[(oc * OUT_H + oy) * OUT_W + ox] = best;
+                } else {
+                    out[(oy * OUT_W + ox) * OUT_C + oc] = best;
+                }
+            }
+        }
+    }
+}
+
+
+/**
+ * @brief Fully connected layer, weights [out][in].
+ */
+template <int IN, int OUT>
+static void fully_connected(const float* in, const float* w, const float* b, float* out) {
+    for (int o = 0; o < OUT; o++) {
+        const float* row = w + o * IN;
+        float acc = b[o];
+        for (int i = 0; i < IN; i++) {
+            acc += in[i] * row[i];
+        }
+        out[o] = acc;
+    }
+}
+
+
+void GestureCNN::run(const float* input, float* output) {
+    // A 1-channel NCHW input has the same memory layout as HWC
+    conv3x3_relu_maxpool2<kInputH, kInputW, 1, kConv1C, false>(input, conv1_w_, conv1_b_, pool1_);
+    if (flatten_chw_) {
+        conv3x3_relu_maxpool2<kPool1H, kPool1W, kConv1C, kConv2C, true>(pool1_, conv2_w_, conv2_b_,
+                                                                        features_);
+    } else {
+        conv3x3_relu_maxpool2<kPool1H, kPool1W, kConv1C, kConv2C, false>(pool1_, conv2_w_, conv2_b_,
+                                                                         features_);
+    }
+    fully_connected<kFeatures, kClasses>(features_, fc_w_, fc_b_, output);
+}
+
+
+/**
+ * @brief Returns the float data of a constant tensor, or nullptr if the shape or type differ.
+ */
+static const float* constant_tensor(const tflite::Model* model, const tflite::SubGraph* graph,
+                                    int index, std::initializer_list<int> shape) {
+    const tflite::Tensor* tensor = graph->tensors()->Get(index);
+    if (tensor->type() != tflite::TensorType_FLOAT32 || !tensor->shape() ||
+        !std::equal(shape.begin(), shape.end(), tensor->shape()->begin(), tensor->shape()->end())) {
+        return nullptr;
+    }
+
+    const tflite::Buffer* buffer = model->buffers()->Get(tensor->buffer());
+    if (!buffer || !buffer->data()) {
+        return nullptr;
+    }
+
+    size_t count = 1;
+    for (int dim : shape) {
+        count *= dim;
+    }
+    const uint8_t* data = buffer->data()->data();
+    if (buffer->data()->size() != count * sizeof(float) ||
+        reinterpret_cast<uintptr_t>(data) % alignof(float) != 0) {
+        return nullptr;
+    }
+    return reinterpret_cast<const float*>(data);
+}
+
+
+/**
+ * @brief Checks that a conv has a 1x1 stride, VALID padding and a fused ReLU.
+ */
+template <typename Options>
+static bool is_valid_relu_conv(const Options* options) {
+    return options && options->padding() == tflite::Padding_VALID && options->stride_w() == 1 &&
+           options->stride_h() == 1 &&
+           options->fused_activation_function() == tflite::ActivationFunctionType_RELU;
+}
+
+
+bool GestureCNN::load(const tflite::Model* model) {
+    const tflite::SubGraph* graph = model->subgraphs()->Get(0);
+    int convs = 0, pools = 0, fcs = 0;
+    bool transposed = false;
+    int chw_tensor = -1; // TRANSPOSE output, followed through RESHAPE
+
+    for (const tflite::Operator* op : *graph->operators()) {
+        tflite::BuiltinOperator code = tflite::GetBuiltinCode(model->operator_codes()->Get(op->opcode_index()));
+        const auto* inputs = op->inputs();
+
+        switch (code) {
+            case tflite::BuiltinOperator_DEPTHWISE_CONV_2D: {
+                // 1-channel input: depthwise with multiplier 8 is the first conv, filter [1][ky][kx][out]
+                const float* w = constant_tensor(model, graph, inputs->Get(1), {1, 3, 3, kConv1C});
+                const float* b = constant_tensor(model, graph, inputs->Get(2), {kConv1C});
+                if (convs != 0 || !w || !b || !is_valid_relu_conv(op->builtin_options_as_DepthwiseConv2DOptions())) {
+                    ESP_LOGW(TAG, "Unexpected DEPTHWISE_CONV_2D");
+                    return false;
+                }
+                for (int oc = 0; oc < kConv1C; oc++) {
+                    for (int k = 0; k < 3 * 3; k++) {
+                        conv1_w_[oc * 3 * 3 + k] = w[k * kConv1C + oc];
+                    }
+                }
+                std::memcpy(conv1_b_, b, sizeof(conv1_b_));
+                convs++;
+                break;
+            }
+            case tflite::BuiltinOperator_CONV_2D: {
+                const int out_c = convs == 0 ? kConv1C : kConv2C;
+                const int in_c = convs == 0 ? 1 : kConv1C;
+                const float* w = constant_tensor(model, graph, inputs->Get(1), {out_c, 3, 3, in_c});
+                const float* b = constant_tensor(model, graph, inputs->Get(2), {out_c});
+                if (convs > 1 || !w || !b || !is_valid_relu_conv(op->builtin_options_as_Conv2DOptions())) {
+                    ESP_LOGW(TAG, "Unexpected CONV_2D");
+                    return false;
+                }
+                std::memcpy(convs == 0 ? conv1_w_ : conv2_w_, w, out_c * 3 * 3 * in_c * sizeof(float));
+                std::memcpy(convs == 0 ? conv1_b_ : conv2_b_, b, out_c * sizeof(float));
+                convs++;
+                break;
+            }
+            case tflite::BuiltinOperator_MAX_POOL_2D: {
+                const tflite::Pool2DOptions* options = op->builtin_options_as_Pool2DOptions();
+                if (pools != convs - 1 || !options || options->filter_width() != 2 ||
+                    options->filter_height() != 2 || options->stride_w() != 2 || options->stride_h() != 2 ||
+                    options->fused_activation_function() != tflite::ActivationFunctionType_NONE) {
+                    ESP_LOGW(TAG, "Unexpected MAX_POOL_2D");
+                    return false;
+                }
+                pools++;
+                break;
+            }
+            case tflite::BuiltinOperator_TRANSPOSE:
+                // NHWC -> NCHW before flattening: PyTorch orders FC inputs channel-major
+                chw_tensor = op->outputs()->Get(0);
+                break;
+            case tflite::BuiltinOperator_RESHAPE:
+                if (inputs->Get(0) == chw_tensor) {
+                    chw_tensor = op->outputs()->Get(0);
+                }
+                break;
+            case tflite::BuiltinOperator_FULLY_CONNECTED: {
+                // Only a TRANSPOSE that actually feeds the flattened features changes their order
+                transposed = inputs->Get(0) == chw_tensor;
+                fc_w_ = constant_tensor(model, graph, inputs->Get(1), {kClasses, kFeatures});
+                fc_b_ = constant_tensor(model, graph, inputs->Get(2), {kClasses});
+                const tflite::FullyConnectedOptions* options = op->builtin_options_as_FullyConnectedOptions();
+                if (pools != 2 || fcs != 0 || !fc_w_ || !fc_b_ ||
+                    (options && options->fused_activation_function() != tflite::ActivationFunctionType_NONE)) {
+                    ESP_LOGW(TAG, "Unexpected FULLY_CONNECTED");
+                    return false;
+                }
+                fcs++;
+                break;
+            }
+            default:
+                ESP_LOGW(TAG, "Unsupported operator %s", tflite::EnumNameBuiltinOperator(code));
+                return false;
+        }
+    }
+
+    if (convs != 2 || pools != 2 || fcs != 1) {
+        ESP_LOGW(TAG, "Graph is not the gesture CNN");
+        return false;
+    }
+
+    flatten_chw_ = transposed;
+    ESP_LOGI(TAG, "Loaded weights, %s flatten order", flatten_chw_ ? "CHW" : "HWC");
+    return true;
+}
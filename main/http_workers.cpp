@@ -0,0 +1,133 @@
+#include "http_workers.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#include <algorithm>
+#include <mutex>
+
+static const char* TAG = "http_workers";
+
+/**
+ * @brief A detached request waiting for a worker.
+ */
+struct HttpJob {
+    httpd_req_t *req;             ///< Copy made by httpd_req_async_handler_begin().
+    HttpWorkers::Handler handler; ///< The handler to run.
+    int64_t queued_us;            ///< esp_timer time of submit().
+};
+
+static QueueHandle_t queue = nullptr;
+static std::mutex stats_mutex;  ///< Guards the counters below.
+static HttpWorkers::Stats counters = {}; ///< mean_* and queue_depth are unused.
+static int64_t total_wait_us = 0;
+static int64_t total_service_us = 0;
+
+
+static void worker_task(void *arg) {
+    HttpJob job;
+    while (true) {
+        if (xQueueReceive(queue, &job, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        const int64_t start_us = esp_timer_get_time();
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            counters.busy_workers++;
+            total_wait_us += start_us - job.queued_us;
+            counters.max_wait_us = std::max(counters.max_wait_us, start_us - job.queued_us);
+        }
+
+        job.handler(job.req);
+        httpd_req_async_handler_complete(job.req);
+
+        const int64_t service_us = esp_timer_get_time() - start_us;
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        counters.busy_workers--;
+        counters.completed++;
+        total_service_us += service_us;
+        counters.max_service_us = std::max(counters.max_service_us, service_us);
+    }
+}
+
+
+esp_err_t HttpWorkers::start() {
+    if (queue) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    queue = xQueueCreate(CONFIG_WEB_ASYNC_QUEUE_DEPTH, sizeof(HttpJob));
+    if (!queue) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Same priority as the server task, so the workers do not starve it
+    for (int i = 0; i < CONFIG_WEB_ASYNC_WORKERS; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "http_worker%d", i);
+        if (xTaskCreate(worker_task, name, 6144, nullptr, tskIDLE_PRIORITY + 5, nullptr) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to start %s", name);
+            return ESP_FAIL;
+        }
+    }
+    ESP_LOGI(TAG, "%d workers, %d queued requests", CONFIG_WEB_ASYNC_WORKERS, CONFIG_WEB_ASYNC_QUEUE_DEPTH);
+    return ESP_OK;
+}
+
+
+esp_err_t HttpWorkers::submit(httpd_req_t *req, Handler handler) {
+    if (!queue) {
+        return handler(req);
+    }
+
+    HttpJob job = {nullptr, handler, esp_timer_get_time()};
+    esp_err_t err = httpd_req_async_handler_begin(req, &job.req);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Cannot detach request: %s", esp_err_to_name(err));
+        httpd_resp_send_500(req);
+        return err;
+    }
+
+    if (xQueueSend(queue, &job, 0) != pdTRUE) {
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            counters.rejected++;
+        }
+        httpd_resp_set_status(job.req, "503 Service Unavailable");
+        httpd_resp_set_hdr(job.req, "Retry-After", "1");
+        httpd_resp_sendstr(job.req, "Busy, try again");
+        return httpd_req_async_handler_complete(job.req);
+    }
+
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    counters.submitted++;
+    counters.max_queue_depth = std::max<uint32_t>(counters.max_queue_depth, uxQueueMessagesWaiting(queue));
+    return ESP_OK;
+}
+
+
+HttpWorkers::Stats HttpWorkers::stats() {
+    Stats stats;
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        stats = counters;
+        uint32_t started = counters.completed + counters.busy_workers;
+        stats.mean_wait_us = started ? total_wait_us / started : 0;
+        stats.mean_service_us = counters.completed ? total_service_us / counters.completed : 0;
+    }
+    stats.queue_depth = queue ? uxQueueMessagesWaiting(queue) : 0;
+    return stats;
+}
+
+
+void HttpWorkers::reset_stats() {
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    const uint32_t busy = counters.busy_workers;
+    counters = {};
+    counters.busy_workers = busy;
+    total_wait_us = 0;
+    total_service_us = 0;
+}
@@ -0,0 +1,800 @@
+#include "inference.h"
+#include "camera.h"
+#include "frame_source.h"
+#include "event_trace.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/queue.h"
+#include "sdkconfig.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+static const char* TAG = "inference";
+
+static std::mutex model_mutex; ///< Serializes access to the shared model.
+
+static std::mutex latest_mutex; ///< Guards latest and published.
+static std::shared_ptr<const InferenceFrame> latest; ///< Last published frame.
+static uint32_t published = 0; ///< Number of published frames.
+static std::condition_variable published_cv; ///< Notified on every publish_frame().
+
+#ifdef CONFIG_CAMERA_JPEG
+static constexpr int kJpegDecodeScale = CONFIG_CAMERA_JPEG_DECODE_SCALE;
+#else
+static constexpr int kJpegDecodeScale = 1;
+#endif
+
+#ifdef CONFIG_MOTION_GATE
+static MotionGate gate(CONFIG_MOTION_GATE_THRESHOLD, CONFIG_MOTION_GATE_MAX_SKIP);
+static Prediction reference_prediction; ///< Prediction on the gate's reference frame, guarded by model_mutex.
+#endif
+
+
+camera_fb_t InferenceFrame::as_fb() const {
+    camera_fb_t fb = {};
+    fb.buf = pixels.get();
+    fb.len = width * height;
+    fb.width = width;
+    fb.height = height;
+    fb.format = PIXFORMAT_GRAYSCALE;
+    return fb;
+}
+
+
+/**
+ * @brief Invokes the model on its filled input tensor and scores the output.
+ *
+ * The caller must hold model_mutex.
+ */
+static esp_err_t invoke_and_score(TFLiteModel* model, Prediction& prediction) {
+    prediction.trace.mark(TracePoint::InferStart);
+    if (model->invoke() != kTfLiteOk) {
+        return ESP_FAIL;
+    }
+    prediction.trace.mark(TracePoint::InferEnd);
+    prediction.inference_us = prediction.trace.get(TracePoint::InferEnd) - prediction.trace.get(TracePoint::InferStart);
+
+    prediction.num_scores = model->output_scores(prediction.scores, Prediction::kMaxScores);
+    if (prediction.num_scores <= 0) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    int argmax = 0;
+    for (int i = 1; i < prediction.num_scores; i++) {
+        if (prediction.scores[i] > prediction.scores[argmax]) {
+            argmax = i;
+        }
+    }
+
+    float sum = 0.0f;
+    for (int i = 0; i < prediction.num_scores; i++) {
+        sum += std::exp(prediction.scores[i] - prediction.scores[argmax]);
+    }
+
+    prediction.class_index = argmax;
+    prediction.confidence = 1.0f / sum;
+    model->set_last_detected_index(argmax);
+    return ESP_OK;
+}
+
+
+#ifdef CONFIG_MOTION_GATE
+/**
+ * @brief Makes a frame the motion gate's reference. The caller must hold model_mutex.
+ */
+static void set_reference(const MotionSignature& signature, const Prediction& prediction) {
+    gate.set_reference(signature);
+    reference_prediction = prediction;
+}
+
+
+/**
+ * @brief Copies the reference prediction into a skipped frame. The caller must hold model_mutex.
+ */
+static void reuse_reference(Prediction& prediction) {
+    prediction.class_index = reference_prediction.class_index;
+    prediction.confidence = reference_prediction.confidence;
+    prediction.num_scores = reference_prediction.num_scores;
+    std::copy_n(reference_prediction.scores, reference_prediction.num_scores, prediction.scores);
+    prediction.inference_us = 0;
+    prediction.reused = true;
+}
+#endif
+
+
+MotionGate* motion_gate() {
+#ifdef CONFIG_MOTION_GATE
+    return &gate;
+#else
+    return nullptr;
+#endif
+}
+
+
+esp_err_t predict_frame(TFLiteModel* model, const uint8_t* pixels, size_t width, size_t height,
+                        Prediction& prediction) {
+    std::lock_guard<std::mutex> lock(model_mutex);
+
+    prediction.trace.mark(TracePoint::PreprocessStart);
+    esp_err_t err = preprocess_grayscale_to_tensor(pixels, width, height, model->input());
+    if (err != ESP_OK) {
+        return err;
+    }
+    prediction.trace.mark(TracePoint::PreprocessEnd);
+    prediction.preprocess_us = prediction.trace.get(TracePoint::PreprocessEnd) - prediction.trace.get(TracePoint::PreprocessStart);
+
+    return invoke_and_score(model, prediction);
+}
+
+
+/**
+ * @brief Returns the pixel buffer size capture_into() needs for a framebuffer.
+ */
+static size_t pixel_bytes(const camera_fb_t* fb) {
+    if (fb->format == PIXFORMAT_JPEG) {
+        size_t width, height;
+        decoded_jpeg_size(fb, kJpegDecodeScale, width, height);
+        return width * height * 3; // The decoder writes RGB888 before converting in place
+    }
+    return fb->width * fb->height;
+}
+
+
+/**
+ * @brief Takes a frame from the frame source and copies it to PSRAM.
+ *
+ * The source's framebuffer is returned right after the copy. A JPEG frame is
+ * kept as the frame's JPEG and decoded at 1/kJpegDecodeScale for the pixels.
+ *
+ * @param frame The frame to fill. Its prediction and JPEG are cleared.
+ * @param capacity Size of frame.pixels, or 0 to allocate them.
+ * @param frame_id The sequence number to give the frame.
+ * @param not_before_us If not 0, flush frames captured before this esp_timer time.
+ * @return true on success.
+ */
+static bool capture_into(InferenceFrame& frame, size_t capacity, uint32_t frame_id, int64_t not_before_us = 0) {
+    FrameSource& source = FrameSource::getInstance();
+    camera_fb_t* fb = not_before_us ? source.fb_get_fresh(not_before_us) : source.fb_get();
+    if (!fb) {
+        ESP_LOGE(TAG, "Camera capture failed");
+        return false;
+    }
+
+    const size_t size = pixel_bytes(fb);
+    if (capacity == 0) {
+        frame.pixels.reset((uint8_t*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM));
+    } else if (size > capacity) {
+        ESP_LOGE(TAG, "Frame of %zu bytes does not fit the %zu byte pool buffers", size, capacity);
+        source.fb_return(fb);
+        return false;
+    }
+    if (!frame.pixels) {
+        ESP_LOGE(TAG, "Cannot allocate frame copy");
+        source.fb_return(fb);
+        return false;
+    }
+
+    frame.prediction = Prediction();
+    frame.prediction.frame_id = frame_id;
+    frame.prediction.capture_us = FrameSource::timestamp_us(fb);
+    frame.prediction.trace.frame_id = frame_id;
+    frame.prediction.trace.set(TracePoint::Capture, frame.prediction.capture_us);
+    if (fb->format == PIXFORMAT_JPEG) {
+        // The sensor's JPEG is the preview, the model gets a reduced-scale decode
+        decoded_jpeg_size(fb, kJpegDecodeScale, frame.width, frame.height);
+        frame.jpeg = copy_jpeg(fb);
+        esp_err_t err = decode_jpeg_to_grayscale(fb, kJpegDecodeScale, frame.pixels.get(), size);
+        source.fb_return(fb);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "JPEG decode failed: %s", esp_err_to_name(err));
+            return false;
+        }
+    } else {
+        frame.width = fb->width;
+        frame.height = fb->height;
+        frame.jpeg.reset();
+        memcpy(frame.pixels.get(), fb->buf, size);
+        source.fb_return(fb);
+    }
+    frame.prediction.trace.mark(TracePoint::Captured);
+    return true;
+}
+
+
+/**
+ * @brief Captures into a newly allocated frame, see capture_into().
+ */
+static std::shared_ptr<InferenceFrame> capture_frame(uint32_t frame_id, int64_t not_before_us) {
+    auto frame = std::make_shared<InferenceFrame>();
+    return capture_into(*frame, 0, frame_id, not_before_us) ? frame : nullptr;
+}
+
+
+std::shared_ptr<InferenceFrame> capture_and_predict(TFLiteModel* model, uint32_t frame_id) {
+    // On demand, the frame must show the scene after the request, not a buffer left from before
+    std::shared_ptr<InferenceFrame> frame = capture_frame(frame_id, esp_timer_get_time());
+    if (!frame) {
+        return nullptr;
+    }
+
+#ifdef CONFIG_MOTION_GATE
+    MotionSignature signature;
+    signature.compute(frame->pixels.get(), frame->width, frame->height);
+    if (gate.unchanged(signature)) {
+        std::lock_guard<std::mutex> lock(model_mutex);
+        reuse_reference(frame->prediction);
+        return frame;
+    }
+#endif
+
+    esp_err_t err = predict_frame(model, frame->pixels.get(), frame->width, frame->height,
+                                  frame->prediction);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Inference failed: %s", esp_err_to_name(err));
+        return nullptr;
+    }
+
+#ifdef CONFIG_MOTION_GATE
+    std::lock_guard<std::mutex> lock(model_mutex);
+    set_reference(signature, frame->prediction);
+#endif
+    return frame;
+}
+
+
+/**
+ * @brief One execution of capture_shared() and the callers sharing it.
+ */
+struct CaptureFlight {
+    int64_t started_us = 0;  ///< esp_timer time the first caller arrived.
+    bool done = false;       ///< The result is set.
+    uint32_t waiters = 0;    ///< Callers that joined.
+    std::shared_ptr<const InferenceFrame> frame; ///< The result, nullptr on failure.
+};
+
+static constexpr int64_t kCoalesceWindowUs = CONFIG_CAPTURE_COALESCE_WINDOW_MS * 1000;
+static std::mutex flight_mutex;              ///< Guards flight and coalesce_stats.
+static std::condition_variable flight_cv;    ///< Notified when a flight is done.
+static std::shared_ptr<CaptureFlight> flight; ///< The most recent flight.
+static CoalesceStats coalesce_stats;
+
+/// Last frame id handed out, shared by capture_shared() and the capture stage so ids never repeat
+static std::atomic<uint32_t> last_frame_id{0};
+
+
+std::shared_ptr<const InferenceFrame> capture_shared(TFLiteModel* model) {
+    const int64_t now = esp_timer_get_time();
+    std::unique_lock<std::mutex> lock(flight_mutex);
+    coalesce_stats.requests++;
+    if (kCoalesceWindowUs > 0 && flight && now - flight->started_us <= kCoalesceWindowUs) {
+        // Joins a running flight, or takes the result of one that just landed
+        std::shared_ptr<CaptureFlight> joined = flight;
+        joined->waiters++;
+        coalesce_stats.joined++;
+        coalesce_stats.max_waiters = std::max(coalesce_stats.max_waiters, joined->waiters);
+        flight_cv.wait(lock, [&] { return joined->done; });
+        return joined->frame;
+    }
+
+    auto own = std::make_shared<CaptureFlight>();
+    own->started_us = now;
+    flight = own;
+    coalesce_stats.flights++;
+    const uint32_t frame_id = ++last_frame_id;
+    lock.unlock();
+
+    std::shared_ptr<InferenceFrame> captured = capture_and_predict(model, frame_id);
+    if (captured && kCoalesceWindowUs > 0) {
+        // Encoded once here, so every caller sends the same bytes
+        FrameTrace& trace = captured->prediction.trace;
+        trace.mark(TracePoint::EncodeStart);
+        if (!captured->jpeg) {
+            camera_fb_t fb = captured->as_fb();
+            captured->jpeg = convert_grayscale_to_jpeg(&fb);
+        }
+        trace.mark(TracePoint::EncodeEnd);
+        captured->prediction.encode_us = trace.get(TracePoint::EncodeEnd) - trace.get(TracePoint::EncodeStart);
+    }
+    if (captured) {
+        captured->prediction.trace.mark(TracePoint::Published);
+        captured->prediction.published_us = captured->prediction.trace.get(TracePoint::Published);
+        publish_frame(captured);
+    }
+
+    lock.lock();
+    own->frame = captured;
+    own->done = true;
+    coalesce_stats.failed += captured == nullptr;
+    lock.unlock();
+    flight_cv.notify_all();
+    return captured;
+}
+
+
+CoalesceStats capture_shared_stats() {
+    std::lock_guard<std::mutex> lock(flight_mutex);
+    return coalesce_stats;
+}
+
+
+void reset_capture_shared_stats() {
+    std::lock_guard<std::mutex> lock(flight_mutex);
+    coalesce_stats = CoalesceStats();
+}
+
+
+void publish_frame(std::shared_ptr<const InferenceFrame> frame) {
+    {
+        std::lock_guard<std::mutex> lock(latest_mutex);
+        latest = std::move(frame);
+        published++;
+    }
+    published_cv.notify_all();
+}
+
+
+std::shared_ptr<const InferenceFrame> wait_for_frame(uint32_t& seen, int timeout_ms) {
+    std::unique_lock<std::mutex> lock(latest_mutex);
+    published_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&] { return published != seen; });
+    if (published == seen) {
+        return nullptr;
+    }
+    seen = published;
+    return latest;
+}
+
+
+std::shared_ptr<const InferenceFrame> latest_frame() {
+    std::lock_guard<std::mutex> lock(latest_mutex);
+    return latest;
+}
+
+
+uint32_t frames_published() {
+    std::lock_guard<std::mutex> lock(latest_mutex);
+    return published;
+}
+
+
+/// Room for the control block of a pooled frame's shared_ptr, see ControlBlockAllocator
+static constexpr size_t kControlBlockBytes = 64;
+
+/**
+ * @brief A frame travelling through the pipeline, preallocated by InferencePipeline::start().
+ */
+struct PipelineItem {
+    std::shared_ptr<InferenceFrame> frame;           ///< Shares storage while the item is in a stage, empty otherwise.
+    std::unique_ptr<uint8_t, HeapCapsDeleter> input; ///< Preprocessed model input (in internal DRAM).
+#ifdef CONFIG_MOTION_GATE
+    MotionSignature signature; ///< Motion signature of the frame.
+    bool reuse = false;        ///< The gate found the frame unchanged, skip preprocessing and inference.
+#endif
+    InferenceFrame storage; ///< The frame and its pixel buffer.
+    alignas(std::max_align_t) uint8_t control_block[kControlBlockBytes]; ///< Control block of frame.
+};
+
+
+/**
+ * @brief Allocator that places a shared_ptr control block in its item, so sharing a pooled frame allocates nothing.
+ */
+template <typename T>
+struct ControlBlockAllocator {
+    using value_type = T;
+    uint8_t* block; ///< PipelineItem::control_block.
+
+    explicit ControlBlockAllocator(uint8_t* block) : block(block) {}
+    template <typename U>
+    ControlBlockAllocator(const ControlBlockAllocator<U>& other) : block(other.block) {}
+
+    T* allocate(size_t n) {
+        static_assert(sizeof(T) <= kControlBlockBytes && alignof(T) <= alignof(std::max_align_t),
+                      "Increase kControlBlockBytes");
+        return reinterpret_cast<T*>(block);
+    }
+    void deallocate(T*, size_t) {}
+
+    template <typename U>
+    bool operator==(const ControlBlockAllocator<U>& other) const { return block == other.block; }
+    template <typename U>
+    bool operator!=(const ControlBlockAllocator<U>& other) const { return block != other.block; }
+};
+
+
+/**
+ * @brief A pipeline stage: its task, input queue and counters.
+ */
+struct PipelineStage {
+    const char* name;                    ///< Task and stage name.
+    bool (*process)(PipelineItem& item); ///< Processes a frame, false to discard it.
+    uint32_t stack_size;                 ///< Task stack size.
+    QueueHandle_t queue;                 ///< Input queue, nullptr for the capture stage.
+    uint32_t processed;                  ///< See StageStats.
+    uint32_t failed;                     ///< See StageStats.
+    uint32_t dropped;                    ///< See StageStats.
+    uint32_t max_queue_depth;            ///< See StageStats.
+    int64_t total_service_us;            ///< Sum of all service times.
+    int64_t max_service_us;              ///< See StageStats.
+};
+
+static TFLiteModel* pipeline_model = nullptr; ///< The model used by the inference stage.
+static portMUX_TYPE stats_mux = portMUX_INITIALIZER_UNLOCKED; ///< Guards the stage counters.
+
+/// Queue depth x stages + 1 for the published frame; capture waits when all are in use
+static constexpr int kPoolItems = CONFIG_PIPELINE_QUEUE_DEPTH * InferencePipeline::kNumStages + 1;
+static PipelineItem pool[kPoolItems];     ///< Items and their buffers, allocated by start().
+static QueueHandle_t free_items = nullptr; ///< Items whose frame nobody holds.
+static size_t pool_pixel_bytes = 0;       ///< Capacity of every item's frame pixels.
+static uint32_t pool_waits = 0;           ///< See FramePoolStats, guarded by stats_mux.
+
+
+/**
+ * @brief Deleter of a pooled frame: returns its item to the free queue.
+ *
+ * Runs when the last holder lets go, which is a stage for a discarded frame
+ * and the last reader for a published one.
+ */
+struct RecycleItem {
+    PipelineItem* item; ///< The item owning the frame.
+
+    void operator()(InferenceFrame* frame) const {
+        frame->jpeg.reset(); // Back to the JpegPool now rather than at the next capture
+        PipelineItem* free_item = item;
+        xQueueSend(free_items, &free_item, 0); // Sized for every item, cannot be full
+    }
+};
+
+
+/**
+ * @brief Takes an item from the free queue for a new capture, waiting if all are in use.
+ */
+static PipelineItem* acquire_item() {
+    PipelineItem* item = nullptr;
+    if (xQueueReceive(free_items, &item, 0) != pdTRUE) {
+        taskENTER_CRITICAL(&stats_mux);
+        pool_waits++;
+        taskEXIT_CRITICAL(&stats_mux);
+        while (xQueueReceive(free_items, &item, portMAX_DELAY) != pdTRUE) {
+        }
+    }
+#ifdef CONFIG_MOTION_GATE
+    item->reuse = false;
+#endif
+    item->frame = std::shared_ptr<InferenceFrame>(&item->storage, RecycleItem{item},
+                                                  ControlBlockAllocator<InferenceFrame>(item->control_block));
+    return item;
+}
+
+
+/**
+ * @brief Ends a stage's hold on an item.
+ *
+ * The item goes back to the free queue once readers of its published frame
+ * let go too, so it must not be touched afterwards.
+ */
+static void release_item(PipelineItem* item) {
+    item->frame.reset();
+}
+
+
+static bool capture_stage(PipelineItem& item) {
+    return capture_into(*item.frame, pool_pixel_bytes, ++last_frame_id);
+}
+
+
+static bool preprocess_stage(PipelineItem& item) {
+    // Type, shape and quantization of the input tensor do not change after init
+    const TfLiteTensor* input = pipeline_model->input();
+    InferenceFrame& frame = *item.frame;
+
+    frame.prediction.trace.mark(TracePoint::PreprocessStart);
+    int64_t start = frame.prediction.trace.get(TracePoint::PreprocessStart);
+#ifdef CONFIG_MOTION_GATE
+    item.signature.compute(frame.pixels.get(), frame.width, frame.height);
+    if (gate.unchanged(item.signature)) {
+        item.reuse = true;
+        frame.prediction.trace.mark(TracePoint::PreprocessEnd);
+        frame.prediction.preprocess_us = frame.prediction.trace.get(TracePoint::PreprocessEnd) - start;
+        return true;
+    }
+#endif
+    esp_err_t err = preprocess_grayscale(frame.pixels.get(), frame.width, frame.height, input,
+                                         item.input.get());
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Preprocessing failed: %s", esp_err_to_name(err));
+        return false;
+    }
+    frame.prediction.trace.mark(TracePoint::PreprocessEnd);
+    frame.prediction.preprocess_us = frame.prediction.trace.get(TracePoint::PreprocessEnd) - start;
+    return true;
+}
+
+
+static bool infer_stage(PipelineItem& item) {
+    esp_err_t err;
+    {
+        std::lock_guard<std::mutex> lock(model_mutex);
+#ifdef CONFIG_MOTION_GATE
+        // The reference may be a few frames newer than the one the gate compared
+        // against, which only makes the reused prediction fresher
+        if (item.reuse) {
+            reuse_reference(item.frame->prediction);
+            return true;
+        }
+#endif
+        TfLiteTensor* input = pipeline_model->input();
+        memcpy(input->data.raw, item.input.get(), input->bytes);
+        err = invoke_and_score(pipeline_model, item.frame->prediction);
+#ifdef CONFIG_MOTION_GATE
+        if (err == ESP_OK) {
+            set_reference(item.signature, item.frame->prediction);
+        }
+#endif
+    }
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Inference failed: %s", esp_err_to_name(err));
+        return false;
+    }
+    return true;
+}
+
+
+static bool encode_stage(PipelineItem& item) {
+    InferenceFrame& frame = *item.frame;
+    if (frame.jpeg) {
+        return true; // Encoded by the sensor
+    }
+    FrameTrace& trace = frame.prediction.trace;
+    trace.mark(TracePoint::EncodeStart);
+    camera_fb_t fb = frame.as_fb();
+    frame.jpeg = convert_grayscale_to_jpeg(&fb);
+    trace.mark(TracePoint::EncodeEnd);
+    frame.prediction.encode_us = trace.get(TracePoint::EncodeEnd) - trace.get(TracePoint::EncodeStart);
+
+    // Publish without a JPEG rather than not at all, readers encode on demand
+    if (!frame.jpeg) {
+        ESP_LOGW(TAG, "JPEG encoding failed for frame %lu", (unsigned long)frame.prediction.frame_id);
+    }
+    return true;
+}
+
+
+static bool publish_stage(PipelineItem& item) {
+    Prediction& prediction = item.frame->prediction;
+    prediction.trace.mark(TracePoint::Published);
+    prediction.published_us = prediction.trace.get(TracePoint::Published);
+    publish_frame(item.frame);
+    return true;
+}
+
+
+static PipelineStage stages[InferencePipeline::kNumStages] = {
+    {"capture", capture_stage, 4096},
+    {"preprocess", preprocess_stage, 4096},
+    {"infer", infer_stage, CONFIG_CONTINUOUS_INFERENCE_STACK_SIZE},
+    {"encode", encode_stage, 6144},
+    {"publish", publish_stage, 3072},
+};
+
+
+/**
+ * @brief Hands a frame to a stage, dropping a frame if its queue is full.
+ */
+static void push(int index, PipelineItem* item) {
+    PipelineStage& stage = stages[index];
+    bool dropped = false;
+
+    if (xQueueSend(stage.queue, &item, 0) != pdTRUE) {
+        dropped = true;
+#ifdef CONFIG_PIPELINE_DROP_OLDEST
+        // Each queue has a single producer, so the freed slot cannot be taken by another frame
+        PipelineItem* oldest = nullptr;
+        if (xQueueReceive(stage.queue, &oldest, 0) == pdTRUE) {
+            release_item(oldest);
+        }
+        if (xQueueSend(stage.queue, &item, 0) == pdTRUE) {
+            item = nullptr;
+        }
+#endif
+        if (item) {
+            release_item(item);
+        }
+    }
+
+    uint32_t depth = uxQueueMessagesWaiting(stage.queue);
+    taskENTER_CRITICAL(&stats_mux);
+    stage.max_queue_depth = std::max(stage.max_queue_depth, depth);
+    stage.dropped += dropped;
+    taskEXIT_CRITICAL(&stats_mux);
+}
+
+
+/**
+ * @brief Task body shared by all stages.
+ *
+ * Takes a frame from the stage's input queue (the capture stage takes a free
+ * one), processes it and hands it to the next stage.
+ *
+ * @param arg The stage index.
+ */
+static void stage_task(void* arg) {
+    const int index = (int)(intptr_t)arg;
+    PipelineStage& stage = stages[index];
+
+    while (true) {
+        PipelineItem* item = nullptr;
+        if (!stage.queue) {
+            item = acquire_item();
+        } else if (xQueueReceive(stage.queue, &item, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+
+        int64_t start = esp_timer_get_time();
+        bool ok = stage.process(*item);
+        int64_t end = esp_timer_get_time();
+        int64_t elapsed = end - start;
+#ifdef CONFIG_EVENT_TRACE
+        EventTrace::record(stage.name, start, end);
+#endif
+
+        taskENTER_CRITICAL(&stats_mux);
+        if (ok) {
+            stage.processed++;
+        } else {
+            stage.failed++;
+        }
+        stage.total_service_us += elapsed;
+        stage.max_service_us = std::max(stage.max_service_us, elapsed);
+        taskEXIT_CRITICAL(&stats_mux);
+
+        if (!ok) {
+            release_item(item);
+            if (!stage.queue) {
+                vTaskDelay(pdMS_TO_TICKS(100)); // Do not spin on a failing camera
+            }
+        } else if (index + 1 < InferencePipeline::kNumStages) {
+            push(index + 1, item);
+        } else {
+            release_item(item);
+        }
+    }
+}
+
+
+esp_err_t InferencePipeline::start(TFLiteModel* model) {
+    if (running_) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    pipeline_model = model;
+
+    // Size the pixel buffers from a frame, the source does not change resolution afterwards
+    FrameSource& source = FrameSource::getInstance();
+    camera_fb_t* fb = source.fb_get();
+    if (!fb) {
+        ESP_LOGE(TAG, "Camera capture failed");
+        return ESP_FAIL;
+    }
+    pool_pixel_bytes = pixel_bytes(fb);
+    source.fb_return(fb);
+
+    free_items = xQueueCreate(kPoolItems, sizeof(PipelineItem*));
+    if (!free_items) {
+        return ESP_ERR_NO_MEM;
+    }
+    const size_t input_bytes = model->input()->bytes;
+    for (PipelineItem& item : pool) {
+        item.storage.pixels.reset((uint8_t*)heap_caps_malloc(pool_pixel_bytes, MALLOC_CAP_SPIRAM));
+        item.input.reset((uint8_t*)heap_caps_malloc(input_bytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+        if (!item.storage.pixels || !item.input) {
+            ESP_LOGE(TAG, "Cannot allocate %d pipeline frames of %zu + %zu bytes", kPoolItems,
+                     pool_pixel_bytes, input_bytes);
+            return ESP_ERR_NO_MEM;
+        }
+        PipelineItem* free_item = &item;
+        xQueueSend(free_items, &free_item, 0);
+    }
+
+    for (int i = Preprocess; i < kNumStages; i++) {
+        stages[i].queue = xQueueCreate(CONFIG_PIPELINE_QUEUE_DEPTH, sizeof(PipelineItem*));
+        if (!stages[i].queue) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    // Inference gets its own core, the cheaper stages share the other one with the HTTP server
+    const BaseType_t infer_core = CONFIG_CONTINUOUS_INFERENCE_CORE;
+    const BaseType_t other_core = 1 - infer_core;
+
+    // Start from the end, so every stage finds its consumer running
+    for (int i = kNumStages - 1; i >= 0; i--) {
+        BaseType_t created = xTaskCreatePinnedToCore(stage_task, stages[i].name, stages[i].stack_size,
+                                                     (void*)(intptr_t)i, CONFIG_CONTINUOUS_INFERENCE_PRIORITY,
+                                                     nullptr, i == Infer ? infer_core : other_core);
+        if (created != pdPASS) {
+            ESP_LOGE(TAG, "Cannot create %s task", stages[i].name);
+            return ESP_FAIL;
+        }
+    }
+
+    running_ = true;
+    ESP_LOGI(TAG, "Pipeline started: inference on core %d, queue depth %d, %d frames of %zu bytes, drop %s",
+             (int)infer_core, CONFIG_PIPELINE_QUEUE_DEPTH, kPoolItems, pool_pixel_bytes,
+#ifdef CONFIG_PIPELINE_DROP_OLDEST
+             "oldest"
+#else
+             "newest"
+#endif
+    );
+    return ESP_OK;
+}
+
+
+StageStats InferencePipeline::stats(Stage index) {
+    const PipelineStage& stage = stages[index];
+    StageStats stats;
+    stats.name = stage.name;
+
+    taskENTER_CRITICAL(&stats_mux);
+    stats.processed = stage.processed;
+    stats.failed = stage.failed;
+    stats.dropped = stage.dropped;
+    stats.max_queue_depth = stage.max_queue_depth;
+    uint32_t count = stage.processed + stage.failed;
+    stats.mean_service_us = count ? stage.total_service_us / count : 0;
+    stats.max_service_us = stage.max_service_us;
+    taskEXIT_CRITICAL(&stats_mux);
+
+    stats.queue_depth = stage.queue ? uxQueueMessagesWaiting(stage.queue) : 0;
+    return stats;
+}
+
+
+FramePoolStats InferencePipeline::pool_stats() {
+    FramePoolStats stats;
+    stats.frames = kPoolItems;
+    stats.pixel_bytes = pool_pixel_bytes;
+    stats.free = free_items ? uxQueueMessagesWaiting(free_items) : 0;
+    taskENTER_CRITICAL(&stats_mux);
+    stats.waits = pool_waits;
+    taskEXIT_CRITICAL(&stats_mux);
+    return stats;
+}
+
+
+void InferencePipeline::reset_stats() {
+    taskENTER_CRITICAL(&stats_mux);
+    pool_waits = 0;
+    for (PipelineStage& stage : stages) {
+        stage.processed = 0;
+        stage.failed = 0;
+        stage.dropped = 0;
+        stage.max_queue_depth = 0;
+        stage.total_service_us = 0;
+        stage.max_service_us = 0;
+    }
+    taskEXIT_CRITICAL(&stats_mux);
+}
+
+
+void InferencePipeline::log_stats() {
+    ESP_LOGI(TAG, "%-10s %9s %6s %7s %5s %5s %9s %9s", "stage", "processed", "failed", "dropped",
+             "queue", "max", "mean [us]", "max [us]");
+    for (int i = 0; i < kNumStages; i++) {
+        StageStats s = stats(static_cast<Stage>(i));
+        ESP_LOGI(TAG, "%-10s %9lu %6lu %7lu %5lu %5lu %9lld %9lld", s.name, (unsigned long)s.processed,
+                 (unsigned long)s.failed, (unsigned long)s.dropped, (unsigned long)s.queue_depth,
+                 (unsigned long)s.max_queue_depth, s.mean_service_us, s.max_service_us);
+    }
+#ifdef CONFIG_MOTION_GATE
+    MotionGate::Stats g = gate.stats();
+    ESP_LOGI(TAG, "motion gate: %lu executed, %lu skipped, last difference %lu",
+             (unsigned long)g.executed, (unsigned long)g.skipped, (unsigned long)g.last_difference);
+#endif
+}
@@ -0,0 +1,106 @@
+#include "jpeg_pool.h"
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+#include <algorithm>
+
+static const char* TAG = "jpeg_pool";
+
+
+JpegPool& JpegPool::getInstance() {
+    static JpegPool pool;
+    return pool;
+}
+
+
+esp_err_t JpegPool::init(size_t count, size_t buffer_size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (memory_) {
+        return ESP_OK;
+    }
+
+    // One block for all buffers, so the pool itself does not fragment PSRAM
+    memory_ = (uint8_t*)heap_caps_malloc(count * buffer_size, MALLOC_CAP_SPIRAM);
+    if (!memory_) {
+        ESP_LOGE(TAG, "Cannot allocate %u x %u bytes", (unsigned)count, (unsigned)buffer_size);
+        return ESP_ERR_NO_MEM;
+    }
+
+    slots_.resize(count);
+    free_.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        slots_[i] = {};
+        slots_[i].buf = memory_ + i * buffer_size;
+        slots_[i].format = PIXFORMAT_JPEG;
+        free_.push_back(count - 1 - i);
+    }
+    buffer_size_ = buffer_size;
+    stats_.buffers = count;
+    stats_.buffer_size = buffer_size;
+
+    ESP_LOGI(TAG, "%u JPEG buffers of %u bytes", (unsigned)count, (unsigned)buffer_size);
+    return ESP_OK;
+}
+
+
+camera_fb_t* JpegPool::acquire() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_.empty()) {
+        stats_.exhausted += memory_ != nullptr;
+        return nullptr;
+    }
+
+    camera_fb_t* fb = &slots_[free_.back()];
+    free_.pop_back();
+    stats_.acquired++;
+    stats_.in_use++;
+    stats_.peak_in_use = std::max(stats_.peak_in_use, stats_.in_use);
+    return fb;
+}
+
+
+bool JpegPool::release(camera_fb_t* fb) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (slots_.empty() || fb < slots_.data() || fb >= slots_.data() + slots_.size()) {
+        return false;
+    }
+
+    free_.push_back(fb - slots_.data());
+    stats_.in_use--;
+    return true;
+}
+
+
+void JpegPool::count_overflow() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.overflows++;
+}
+
+
+void JpegPool::count_fallback() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.fallback_allocations++;
+}
+
+
+JpegPool::Stats JpegPool::stats() const {
+    Stats stats;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats = stats_;
+    }
+    stats.psram_free = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    stats.psram_largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM);
+    return stats;
+}
+
+
+void JpegPool::reset_stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.peak_in_use = stats_.in_use;
+    stats_.acquired = 0;
+    stats_.exhausted = 0;
+    stats_.overflows = 0;
+    stats_.fallback_allocations = 0;
+}
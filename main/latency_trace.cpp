@@ -0,0 +1,130 @@
+#include "latency_trace.h"
+
+#include "esp_heap_caps.h"
+#include "sdkconfig.h"
+
+#include <algorithm>
+#include <new>
+
+const char* trace_point_name(TracePoint point) {
+    static const char* const names[] = {
+        "capture", "captured", "preprocess_start", "preprocess_end", "infer_start", "infer_end",
+        "encode_start", "encode_end", "published", "request", "response_start", "response_end",
+    };
+    static_assert(sizeof(names) / sizeof(names[0]) == FrameTrace::kPoints, "one name per point");
+    return names[static_cast<int>(point)];
+}
+
+
+const LatencyTraceRing::Segment LatencyTraceRing::kSegments[] = {
+    {"sensor", TracePoint::Capture, TracePoint::Captured},
+    {"preprocess_wait", TracePoint::Captured, TracePoint::PreprocessStart},
+    {"preprocess", TracePoint::PreprocessStart, TracePoint::PreprocessEnd},
+    {"infer_wait", TracePoint::PreprocessEnd, TracePoint::InferStart},
+    {"infer", TracePoint::InferStart, TracePoint::InferEnd},
+    {"encode_wait", TracePoint::InferEnd, TracePoint::EncodeStart},
+    {"encode", TracePoint::EncodeStart, TracePoint::EncodeEnd},
+    {"publish_wait", TracePoint::EncodeEnd, TracePoint::Published},
+    {"age_at_request", TracePoint::Capture, TracePoint::Request},
+    {"handler", TracePoint::Request, TracePoint::ResponseStart},
+    {"send", TracePoint::ResponseStart, TracePoint::ResponseEnd},
+    {"total", TracePoint::Capture, TracePoint::ResponseEnd},
+};
+const size_t LatencyTraceRing::kNumSegments = sizeof(kSegments) / sizeof(kSegments[0]);
+
+
+LatencyTraceRing::LatencyTraceRing(size_t capacity) : capacity_(capacity) {
+    slots_ = static_cast<Slot*>(heap_caps_malloc(capacity * sizeof(Slot), MALLOC_CAP_SPIRAM));
+    if (!slots_) {
+        capacity_ = 0;
+        return;
+    }
+    for (size_t i = 0; i < capacity_; i++) {
+        new (&slots_[i]) Slot();
+        slots_[i].seq.store(0, std::memory_order_relaxed);
+    }
+}
+
+
+LatencyTraceRing::~LatencyTraceRing() {
+    heap_caps_free(slots_);
+}
+
+
+void LatencyTraceRing::push(const FrameTrace& trace) {
+    if (!capacity_) {
+        return;
+    }
+    const uint32_t index = head_.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = slots_[index % capacity_];
+    slot.seq.store(2 * index + 1, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.trace = trace;
+    slot.seq.store(2 * index + 2, std::memory_order_release);
+}
+
+
+std::vector<FrameTrace> LatencyTraceRing::last(size_t count) const {
+    std::vector<FrameTrace> result;
+    const uint32_t head = head_.load(std::memory_order_acquire);
+    const uint32_t available = std::min<uint32_t>(head, capacity_);
+    count = std::min<size_t>(count, available);
+    result.reserve(count);
+
+    for (uint32_t index = head - count; index != head; index++) {
+        const Slot& slot = slots_[index % capacity_];
+        if (slot.seq.load(std::memory_order_acquire) != 2 * index + 2) {
+            continue; // Still being written, or already overwritten
+        }
+        FrameTrace trace = slot.trace;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) == 2 * index + 2) {
+            result.push_back(trace);
+        }
+    }
+    return result;
+}
+
+
+std::vector<LatencyTraceRing::Summary> LatencyTraceRing::summarize() const {
+    std::vector<FrameTrace> traces = last(capacity_);
+    std::vector<int64_t> durations;
+    durations.reserve(traces.size());
+
+    std::vector<Summary> summaries;
+    for (size_t i = 0; i < kNumSegments; i++) {
+        const Segment& segment = kSegments[i];
+        durations.clear();
+        for (const FrameTrace& trace : traces) {
+            int64_t from = trace.get(segment.from);
+            int64_t to = trace.get(segment.to);
+            if (from && to && to >= from) {
+                durations.push_back(to - from);
+            }
+        }
+
+        Summary s = {segment.name, (uint32_t)durations.size(), 0, 0, 0, 0};
+        if (!durations.empty()) {
+            std::sort(durations.begin(), durations.end());
+            auto rank = [&](int percent) {
+                return durations[(durations.size() * percent + 99) / 100 - 1]; // nearest-rank
+            };
+            s.p50_us = rank(50);
+            s.p90_us = rank(90);
+            s.p99_us = rank(99);
+            s.max_us = durations.back();
+        }
+        summaries.push_back(s);
+    }
+    return summaries;
+}
+
+
+LatencyTraceRing* latency_traces() {
+#ifdef CONFIG_LATENCY_TRACE
+    static LatencyTraceRing ring(CONFIG_LATENCY_TRACE_RECORDS);
+    return &ring;
+#else
+    return nullptr;
+#endif
+}
@@ -18,6 +18,9 @@
 #include "camera.h"
 #include "web_gui.h"
 #include "tflite_model.h"
+#include "inference.h"
+#include "frame_source.h"
+#include "event_trace.h"
 
 /**
  * @brief Logging tag for ESP_LOGx macros.
@@ -72,12 +75,11 @@ void print_memory_stats() {
  */
 int main() {
     ESP_LOGI(TAG, "Initialising...");
-    
-    if (initCamera() != ESP_OK ) {
-        ESP_LOGE(TAG, "Camera initialization failed.");
-        return -1;
-    }
 
+    #ifdef CONFIG_EVENT_TRACE
+    EventTrace::init(CONFIG_EVENT_TRACE_EVENTS);
+    #endif //CONFIG_EVENT_TRACE
+    
     # ifndef CONFIG_ENABLE_QEMU_DEBUG
     WifiManager::initialize();
     WifiManager& wifi_mgr = WifiManager::getInstance();
@@ -93,6 +95,13 @@ int main() {
         return -1;
     }
 
+    // The camera frame size is derived from the model input
+    ImageGeometry geometry = tflite_model->input_geometry();
+    if (FrameSource::initialize(geometry.width, geometry.height) != ESP_OK) {
+        ESP_LOGE(TAG, "Camera initialization failed.");
+        return -1;
+    }
+
     #ifndef CONFIG_ENABLE_QEMU_DEBUG
     ESP_LOGI(TAG, "Waiting for WiFi connection...");
     if (!wifi_mgr.wait_for_connection(30000)) { // 30s timeout
@@ -107,8 +116,23 @@ int main() {
     }
     #endif //CONFIG_ENABLE_QEMU_DEBUG
 
+    #ifdef CONFIG_CONTINUOUS_INFERENCE
+    if (InferencePipeline::start(tflite_model.get()) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start continuous inference");
+        return -1;
+    }
+    #endif //CONFIG_CONTINUOUS_INFERENCE
+
     ESP_LOGI(TAG, "Setup complete");
 
+    #if defined(CONFIG_ENABLE_QEMU_DEBUG) && defined(CONFIG_CONTINUOUS_INFERENCE)
+    // Without a web server, report the pipeline timings on the console
+    while (true) {
+        vTaskDelay(pdMS_TO_TICKS(10000));
+        InferencePipeline::log_stats();
+    }
+    #endif
+
     // Suspend the main task, as all operations are handled by event loops and other tasks
     vTaskSuspend(NULL);
     return 0;
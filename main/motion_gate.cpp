@@ -0,0 +1,67 @@
+#include "motion_gate.h"
+
+#include <cstdlib>
+
+void MotionSignature::compute(const uint8_t* pixels, size_t width, size_t height) {
+    for (int cy = 0; cy < kGrid; cy++) {
+        const size_t y0 = cy * height / kGrid;
+        const size_t y1 = (cy + 1) * height / kGrid;
+        for (int cx = 0; cx < kGrid; cx++) {
+            const size_t x0 = cx * width / kGrid;
+            const size_t x1 = (cx + 1) * width / kGrid;
+
+            uint32_t sum = 0;
+            for (size_t y = y0; y < y1; y++) {
+                const uint8_t* row = pixels + y * width;
+                for (size_t x = x0; x < x1; x++) {
+                    sum += row[x];
+                }
+            }
+            const uint32_t count = (y1 - y0) * (x1 - x0);
+            cells[cy * kGrid + cx] = count ? sum / count : 0;
+        }
+    }
+}
+
+
+bool MotionGate::unchanged(const MotionSignature& signature) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!has_reference_) {
+        return false;
+    }
+
+    constexpr uint32_t kCells = MotionSignature::kGrid * MotionSignature::kGrid;
+    uint32_t sad = 0;
+    for (uint32_t i = 0; i < kCells; i++) {
+        sad += std::abs(signature.cells[i] - reference_.cells[i]);
+    }
+    stats_.last_difference = sad / kCells;
+
+    if (sad >= threshold_ * kCells || (max_skip_ && consecutive_skips_ >= max_skip_)) {
+        return false;
+    }
+    consecutive_skips_++;
+    stats_.skipped++;
+    return true;
+}
+
+
+void MotionGate::set_reference(const MotionSignature& signature) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    reference_ = signature;
+    has_reference_ = true;
+    consecutive_skips_ = 0;
+    stats_.executed++;
+}
+
+
+MotionGate::Stats MotionGate::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+
+void MotionGate::reset_stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_ = {};
+}
@@ -0,0 +1,155 @@
+#include "op_profiler.h"
+
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+
+#include <algorithm>
+
+void OpProfiler::Node::add(uint32_t cycles) {
+    samples[count % kSamples] = cycles;
+    count++;
+    min = std::min(min, cycles);
+    max = std::max(max, cycles);
+    sum += cycles;
+}
+
+
+OpProfiler::OpStats OpProfiler::Node::stats() const {
+    OpStats s = {tag, count, 0, 0, 0, 0};
+    if (count == 0) {
+        return s;
+    }
+
+    uint32_t sorted[kSamples];
+    int n = std::min<uint32_t>(count, kSamples);
+    std::copy(samples, samples + n, sorted);
+    int rank = (n * 99 + 99) / 100 - 1; // nearest-rank percentile
+    std::nth_element(sorted, sorted + rank, sorted + n);
+
+    s.min_cycles = min;
+    s.mean_cycles = sum / count;
+    s.p99_cycles = sorted[rank];
+    s.max_cycles = max;
+    return s;
+}
+
+
+void OpProfiler::begin_invoke() {
+    sampling_ = (invocations_++ % sample_every_) == 0;
+    next_node_ = 0;
+    invoke_core_ = xPortGetCoreID();
+    invoke_start_ = esp_cpu_get_cycle_count();
+}
+
+
+void OpProfiler::end_invoke() {
+    if (!sampling_) {
+        return;
+    }
+    uint32_t cycles = esp_cpu_get_cycle_count() - invoke_start_;
+    sampling_ = false;
+    // Each core has its own cycle counter; a task that migrated mid-invoke has a meaningless delta
+    if (xPortGetCoreID() != invoke_core_) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    total_.tag = "INVOKE";
+    total_.add(cycles);
+}
+
+
+uint32_t OpProfiler::BeginEvent(const char* tag) {
+    // Events outside begin_invoke()/end_invoke() (e.g. during AllocateTensors) are ignored
+    if (!sampling_ || next_node_ >= kMaxOps) {
+        return kNotSampled;
+    }
+
+    uint32_t handle = next_node_++;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (nodes_[handle].tag != tag) {
+        nodes_[handle] = Node(); // graph changed, restart this node
+        nodes_[handle].tag = tag;
+    }
+    num_nodes_ = std::max<int>(num_nodes_, handle + 1);
+    event_core_[handle] = xPortGetCoreID();
+    event_start_[handle] = esp_cpu_get_cycle_count();
+    return handle;
+}
+
+
+void OpProfiler::EndEvent(uint32_t event_handle) {
+    if (event_handle == kNotSampled) {
+        return;
+    }
+    uint32_t cycles = esp_cpu_get_cycle_count() - event_start_[event_handle];
+    if (xPortGetCoreID() != event_core_[event_handle]) {
+        return; // migrated to the other core, see end_invoke()
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    nodes_[event_handle].add(cycles);
+}
+
+
+std::vector<OpProfiler::OpStats> OpProfiler::ops() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<OpStats> result;
+    result.reserve(num_nodes_);
+    for (int i = 0; i < num_nodes_; i++) {
+        result.push_back(nodes_[i].stats());
+    }
+    return result;
+}
+
+
+OpProfiler::OpStats OpProfiler::total() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    OpStats s = total_.stats();
+    s.tag = "INVOKE";
+    return s;
+}
+
+
+float OpProfiler::cycles_to_us(uint32_t cycles) {
+    return (float)cycles / CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ;
+}
+
+
+void OpProfiler::log_report() const {
+    std::vector<OpStats> nodes = ops();
+    OpStats all = total();
+
+    ESP_LOGI(TAG, "=== Op profile (%lu invocations, %lu sampled) ===",
+             (unsigned long)invocations_, (unsigned long)all.count);
+    ESP_LOGI(TAG, "%-3s %-18s %8s %10s %10s %10s", "#", "op", "count", "min [us]", "mean [us]",
+             "p99 [us]");
+
+    uint64_t ops_mean = 0;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        const OpStats& s = nodes[i];
+        ESP_LOGI(TAG, "%-3u %-18s %8lu %10.1f %10.1f %10.1f", (unsigned)i, s.tag,
+                 (unsigned long)s.count, cycles_to_us(s.min_cycles), cycles_to_us(s.mean_cycles),
+                 cycles_to_us(s.p99_cycles));
+        ops_mean += s.mean_cycles;
+    }
+    ESP_LOGI(TAG, "    %-18s %8lu %10.1f %10.1f %10.1f", all.tag, (unsigned long)all.count,
+             cycles_to_us(all.min_cycles), cycles_to_us(all.mean_cycles),
+             cycles_to_us(all.p99_cycles));
+    if (all.mean_cycles > ops_mean) {
+        ESP_LOGI(TAG, "Interpreter overhead outside ops: %.1f us",
+                 cycles_to_us(all.mean_cycles - ops_mean));
+    }
+}
+
+
+void OpProfiler::reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (Node& node : nodes_) {
+        node = Node();
+    }
+    total_ = Node();
+    num_nodes_ = 0;
+}
@@ -0,0 +1,163 @@
+#include "resize.h"
+
+#include <algorithm>
+#include <mutex>
+
+ResizePlan::ResizePlan(int src_w, int src_h, int dst_w, int dst_h, ResizeMode mode)
+    : src_w_(src_w), src_h_(src_h), dst_w_(dst_w), dst_h_(dst_h), mode_(mode),
+      identity_(src_w == dst_w && src_h == dst_h) {
+
+    if (identity_) {
+        return;
+    }
+    x_start_.resize(dst_w);
+    y_offset_.resize(dst_h);
+
+    if (mode == ResizeMode::Nearest) {
+        // Same expression as the original per-pixel loop, so the result is bit-exact
+        float scale_x = (float)src_w / dst_w;
+        float scale_y = (float)src_h / dst_h;
+        for (int x = 0; x < dst_w; x++) {
+            x_start_[x] = (int)(x * scale_x);
+        }
+        for (int y = 0; y < dst_h; y++) {
+            y_offset_[y] = (int)(y * scale_y) * src_w;
+        }
+        return;
+    }
+
+    // Box: output pixel i covers source range [i * src / dst, (i + 1) * src / dst)
+    x_count_.resize(dst_w);
+    y_count_.resize(dst_h);
+    int max_x = 1, max_y = 1;
+    for (int x = 0; x < dst_w; x++) {
+        int begin = std::min(x * src_w / dst_w, src_w - 1);
+        int end = std::max((x + 1) * src_w / dst_w, begin + 1);
+        x_start_[x] = begin;
+        x_count_[x] = end - begin;
+        max_x = std::max(max_x, end - begin);
+    }
+    for (int y = 0; y < dst_h; y++) {
+        int begin = std::min(y * src_h / dst_h, src_h - 1);
+        int end = std::max((y + 1) * src_h / dst_h, begin + 1);
+        y_offset_[y] = begin * src_w;
+        y_count_[y] = end - begin;
+        max_y = std::max(max_y, end - begin);
+    }
+
+    // ceil(2^24 / area) gives an exactly rounded average for areas below 256;
+    // beyond that run_row() divides
+    if (max_x * max_y > kMaxRecipArea) {
+        return;
+    }
+    recip_.resize(max_x * max_y + 1);
+    for (uint32_t area = 1; area < recip_.size(); area++) {
+        recip_[area] = ((1u << kRecipShift) + area - 1) / area;
+    }
+}
+
+
+std::shared_ptr<const ResizePlan> ResizePlan::get(int src_w, int src_h, int dst_w, int dst_h,
+                                                  ResizeMode mode) {
+    if (src_w <= 0 || src_h <= 0 || dst_w <= 0 || dst_h <= 0) {
+        return nullptr;
+    }
+
+    static std::mutex mutex;
+    static std::vector<std::shared_ptr<const ResizePlan>> cache; // most recently used first
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = cache.begin(); it != cache.end(); ++it) {
+        const ResizePlan &p = **it;
+        if (p.src_w_ == src_w && p.src_h_ == src_h && p.dst_w_ == dst_w && p.dst_h_ == dst_h &&
+            p.mode_ == mode) {
+            std::rotate(cache.begin(), it, it + 1);
+            return cache.front();
+        }
+    }
+
+    std::shared_ptr<const ResizePlan> plan(new ResizePlan(src_w, src_h, dst_w, dst_h, mode));
+    if (cache.size() == kCacheSize) {
+        cache.pop_back(); // callers still holding it keep it alive
+    }
+    cache.insert(cache.begin(), plan);
+    return plan;
+}
+
+
+/**
+ * @brief 256-entry table mapping every value to itself.
+ */
+static const uint8_t *identity_lut() {
+    static const auto lut = [] {
+        std::vector<uint8_t> values(256);
+        for (int i = 0; i < 256; i++) {
+            values[i] = i;
+        }
+        return values;
+    }();
+    return lut.data();
+}
+
+
+ResizeStream::ResizeStream(std::shared_ptr<const ResizePlan> plan, uint8_t *dst)
+    : plan_(std::move(plan)), dst_(dst) {
+    int rows = 1;
+    for (int y = 0; y < plan_->dst_h(); y++) {
+        rows = std::max(rows, plan_->row_count(y));
+    }
+    window_.resize((size_t)rows * plan_->src_w());
+}
+
+
+void ResizeStream::push(const uint8_t *data, size_t len) {
+    const int src_w = plan_->src_w();
+    while (len > 0 && !done()) {
+        const size_t n = std::min<size_t>(len, src_w - col_);
+        // Rows between the ones the plan reads are skipped
+        const int first = plan_->row_begin(y_);
+        if (row_ >= first) {
+            std::copy_n(data, n, window_.data() + (size_t)(row_ - first) * src_w + col_);
+        }
+        data += n;
+        len -= n;
+        col_ += n;
+        if (col_ == src_w) {
+            col_ = 0;
+            row_++;
+            emit();
+        }
+    }
+}
+
+
+void ResizeStream::emit() {
+    const int src_w = plan_->src_w();
+    while (!done() && row_ >= plan_->row_begin(y_) + plan_->row_count(y_)) {
+        const int first = plan_->row_begin(y_);
+        plan_->run_row(y_, window_.data(), dst_ + (size_t)y_ * plan_->dst_w(), identity_lut());
+        y_++;
+        if (done()) {
+            return;
+        }
+        // Rows are shared by neighbouring outputs when upscaling
+        const int shift = plan_->row_begin(y_) - first;
+        const int kept = row_ - plan_->row_begin(y_);
+        if (shift > 0 && kept > 0) {
+            std::copy(window_.begin() + (size_t)shift * src_w,
+                      window_.begin() + (size_t)(shift + kept) * src_w, window_.begin());
+        }
+    }
+}
+
+
+const float *normalize_lut() {
+    static const auto lut = [] {
+        std::vector<float> values(256);
+        for (int i = 0; i < 256; i++) {
+            values[i] = normalize_pixel(i);
+        }
+        return values;
+    }();
+    return lut.data();
+}
@@ -1,6 +1,14 @@
 #include "tflite_model.h"
 #include "esp_log.h"
 #include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "resize.h"
+#include "tensorflow/lite/schema/schema_utils.h"
+#include "sdkconfig.h"
+#include "event_trace.h"
+
+#include <algorithm>
+#include <cmath>
   
 TFLiteModel::TFLiteModel(const unsigned char* model_data, const unsigned int* model_size) 
     : model_data_(model_data), 
@@ -29,15 +37,28 @@ bool TFLiteModel::init() {
     op_resolver_.AddMaxPool2D();
     op_resolver_.AddReshape();
     op_resolver_.AddFullyConnected();
-    op_resolver_.AddTranspose();  
+    op_resolver_.AddTranspose(); // only NCHW exports need it, see convert_to_tflite.py --nhwc
     op_resolver_.AddQuantize();
     op_resolver_.AddDequantize();
 
-    tensor_arena_ = (uint8_t*)heap_caps_malloc(kTensorArenaSize, MALLOC_CAP_SPIRAM);
+#ifdef CONFIG_MODEL_PROFILER
+    profiler_ = std::make_unique<OpProfiler>(CONFIG_MODEL_PROFILER_SAMPLE_EVERY);
+#endif
+
+    // Measure how much arena the model actually needs
+    size_t arena_used = measure_arena(model);
+    if (arena_used == 0) {
+        return false;
+    }
+
+    if (!allocate_arena(arena_used + kArenaMargin)) {
+        ESP_LOGE(TAG, "Model: Cannot allocate %zu bytes of tensor arena", arena_used + kArenaMargin);
+        return false;
+    }
 
     // Allocate memory from the tensor_arena for the model's tensors
     interpreter_ = std::make_unique<tflite::MicroInterpreter>(
-        model, op_resolver_, tensor_arena_, kTensorArenaSize);
+        model, op_resolver_, tensor_arena_, tensor_arena_size_, nullptr, profiler_.get());
 
     TfLiteStatus allocate_status = interpreter_->AllocateTensors();
     if (allocate_status != kTfLiteOk) {
@@ -47,7 +68,21 @@ bool TFLiteModel::init() {
 
     input_ = interpreter_->input(0);
     output_ = interpreter_->output(0);
+
+    if (!detect_image_geometry(input_, input_geometry_)) {
+        ESP_LOGE(TAG, "Model: Input tensor is not an image (%d dims)", input_->dims->size);
+        return false;
+    }
+    log_graph(model);
+
+#ifdef CONFIG_MODEL_BACKEND_SPECIALIZED
+    init_specialized(model);
+#endif
+
     initialized_ = true;
+
+    ESP_LOGI(TAG, "Model: input %s, output %s", TfLiteTypeGetName(input_->type),
+             TfLiteTypeGetName(output_->type));
    
     ESP_LOGI(TAG, "Model: Initialized successfully");
 
@@ -56,8 +91,157 @@ bool TFLiteModel::init() {
 }
 
 
+void TFLiteModel::log_graph(const tflite::Model* model) const {
+    const auto* operators = model->subgraphs()->Get(0)->operators();
+    int transposes = 0;
+    for (const tflite::Operator* op : *operators) {
+        auto code = tflite::GetBuiltinCode(model->operator_codes()->Get(op->opcode_index()));
+        transposes += code == tflite::BuiltinOperator_TRANSPOSE;
+    }
+
+    ESP_LOGI(TAG, "Model: %lu ops (%d TRANSPOSE), %s input %dx%dx%d, arena %zu bytes",
+             (unsigned long)operators->size(), transposes,
+             input_geometry_.channels_first ? "NCHW" : "NHWC", input_geometry_.width,
+             input_geometry_.height, input_geometry_.channels, interpreter_->arena_used_bytes());
+}
+
+
+size_t TFLiteModel::measure_arena(const tflite::Model* model) {
+    uint8_t* probe_arena = (uint8_t*)heap_caps_malloc(kProbeArenaSize, MALLOC_CAP_SPIRAM);
+    if (!probe_arena) {
+        ESP_LOGE(TAG, "Model: Cannot allocate %zu bytes of probe arena", kProbeArenaSize);
+        return 0;
+    }
+
+    size_t used = 0;
+    {
+        tflite::MicroInterpreter probe(model, op_resolver_, probe_arena, kProbeArenaSize);
+        if (probe.AllocateTensors() == kTfLiteOk) {
+            used = probe.arena_used_bytes();
+        } else {
+            ESP_LOGE(TAG, "Model: AllocateTensors() failed in %zu bytes probe arena", kProbeArenaSize);
+        }
+    }
+
+    heap_caps_free(probe_arena);
+    return used;
+}
+
+
+bool TFLiteModel::allocate_arena(size_t size) {
+    // Internal DRAM is much faster than PSRAM, but Wi-Fi and httpd need headroom there
+    size_t largest_internal = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (largest_internal >= size + kInternalReserve) {
+        tensor_arena_ = (uint8_t*)heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+
+    arena_internal_ = tensor_arena_ != nullptr;
+    if (!arena_internal_) {
+        tensor_arena_ = (uint8_t*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    }
+    if (!tensor_arena_) {
+        return false;
+    }
+
+    tensor_arena_size_ = size;
+    ESP_LOGI(TAG, "Model: Tensor arena %zu bytes (%zu used + %zu margin) in %s, largest free internal block %zu",
+             size, size - kArenaMargin, kArenaMargin, arena_internal_ ? "internal DRAM" : "PSRAM",
+             largest_internal);
+    return true;
+}
+
+
+void TFLiteModel::init_specialized(const tflite::Model* model) {
+    constexpr int kInputSize = GestureCNN::kInputH * GestureCNN::kInputW;
+    if (input_->type != kTfLiteFloat32 || output_->type != kTfLiteFloat32 ||
+        input_->bytes != kInputSize * sizeof(float) ||
+        output_->bytes != GestureCNN::kClasses * sizeof(float)) {
+        ESP_LOGW(TAG, "Model: Specialized backend needs the float model, using the interpreter");
+        return;
+    }
+
+    auto cnn = std::make_unique<GestureCNN>();
+    if (!cnn->load(model)) {
+        ESP_LOGW(TAG, "Model: Cannot load weights for the specialized backend, using the interpreter");
+        return;
+    }
+
+    // Cross-check both backends on a synthetic image before switching over
+    for (int i = 0; i < kInputSize; i++) {
+        input_->data.f[i] = normalize_pixel((i * 37) % 256);
+    }
+
+    int64_t start = esp_timer_get_time();
+    interpreter_->Invoke();
+    int64_t interpreter_us = esp_timer_get_time() - start;
+
+    float reference[GestureCNN::kClasses];
+    std::copy(output_->data.f, output_->data.f + GestureCNN::kClasses, reference);
+
+    start = esp_timer_get_time();
+    cnn->run(input_->data.f, output_->data.f);
+    int64_t specialized_us = esp_timer_get_time() - start;
+
+    float max_diff = 0.0f;
+    for (int i = 0; i < GestureCNN::kClasses; i++) {
+        // Relative to the logit, absolute below 1, same measure as host_test/gesture_cnn_test.cpp
+        max_diff = std::max(max_diff, std::fabs(output_->data.f[i] - reference[i]) / std::max(1.0f, std::fabs(reference[i])));
+    }
+
+    ESP_LOGI(TAG, "Model: Specialized backend %lld us vs interpreter %lld us, max relative |diff| %g",
+             specialized_us, interpreter_us, max_diff);
+    if (max_diff > kSpecializedTolerance) {
+        ESP_LOGE(TAG, "Model: Specialized backend disagrees with the interpreter, using the interpreter");
+        return;
+    }
+
+    specialized_ = std::move(cnn);
+}
+
+
 TfLiteStatus TFLiteModel::invoke(){
-    return interpreter_->Invoke();
+    TRACE_SCOPE("invoke");
+    if (profiler_) {
+        profiler_->begin_invoke();
+    }
+
+    TfLiteStatus status = kTfLiteOk;
+    if (specialized_) {
+        specialized_->run(input_->data.f, output_->data.f);
+    } else {
+        status = interpreter_->Invoke();
+    }
+
+    if (profiler_) {
+        profiler_->end_invoke();
+    }
+    return status;
+}
+
+
+int TFLiteModel::output_scores(float* scores, int max_count) const {
+    const TfLiteIntArray* dims = output_->dims;
+    int count = std::min(dims->data[dims->size - 1], max_count);
+    const float scale = output_->params.scale;
+    const int32_t zero_point = output_->params.zero_point;
+
+    switch (output_->type) {
+        case kTfLiteFloat32:
+            std::copy(output_->data.f, output_->data.f + count, scores);
+            return count;
+        case kTfLiteInt8:
+            for (int i = 0; i < count; i++) {
+                scores[i] = (output_->data.int8[i] - zero_point) * scale;
+            }
+            return count;
+        case kTfLiteUInt8:
+            for (int i = 0; i < count; i++) {
+                scores[i] = (output_->data.uint8[i] - zero_point) * scale;
+            }
+            return count;
+        default:
+            return -1;
+    }
 }
 
 
@@ -66,3 +250,21 @@ TFLiteModel::~TFLiteModel(){
 }
 
 
+bool detect_image_geometry(const TfLiteTensor* tensor, ImageGeometry& geometry) {
+    const TfLiteIntArray* dims = tensor->dims;
+    if (dims->size == 3) {
+        geometry = {dims->data[1], dims->data[0], dims->data[2], false};
+        return true;
+    }
+    if (dims->size != 4 || dims->data[0] != 1) {
+        return false;
+    }
+
+    auto is_channels = [](int d) { return d == 1 || d == 3; };
+    if (is_channels(dims->data[1]) && !is_channels(dims->data[3])) {
+        geometry = {dims->data[3], dims->data[2], dims->data[1], true};
+    } else {
+        geometry = {dims->data[2], dims->data[1], dims->data[3], false};
+    }
+    return true;
+}
@@ -5,11 +5,28 @@
 #include "esp_log.h"
 #include "esp_camera.h"
 #include "tflite_model.h"
+#include "inference.h"
+#include "frame_source.h"
+#include "jpeg_pool.h"
+#include "http_workers.h"
+#include "event_trace.h"
+#include "esp_timer.h"
 #include "esp_netif.h"
+#include "lwip/sockets.h"
+#include "json.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdarg>
+#include <cstring>
 #include <memory>
+#include <mutex>
 
 static const char* TAG = "server";
 
+#define STRINGIFY_(x) #x
+#define STRINGIFY(x) STRINGIFY_(x)
+
 const char *MAIN_PAGE = R"rawliteral(
 <!DOCTYPE html>
 <html lang="en">
@@ -24,6 +41,7 @@ const char *MAIN_PAGE = R"rawliteral(
     .card { display: inline-block; text-align: center; background: #fff; padding: 15px; border-radius: 10px; box-shadow: 0 4px 8px rgba(0,0,0,0.2); margin-top: 20px; }
     .card img { max-width: 80%; border-radius: 8px;  margin: 0 auto 10px auto;}
     .gesture-name { font-size: 20px; color: #007BFF; margin-top: 10px; display: block; }
+    .details { font-size: 13px; color: #666; margin-top: 4px; display: block; }
 </style>
 </head>
 <body>
@@ -32,11 +50,15 @@ const char *MAIN_PAGE = R"rawliteral(
 <div id="result" class="card">
     <img id="captured-img" src="" alt="Captured image" style="display:none;">
     <span id="gesture-name" class="gesture-name"></span>
+    <span id="details" class="details"></span>
+    <span id="live" class="details"></span>
     <button id="capture-btn" onclick="capture()">Capture & Detect</button>
+    <button id="stream-btn" onclick="toggleStream()">Start live view</button>
 </div>
 
 <script>
 async function capture() {
+    // One request: the prediction of the returned image travels in its headers
     const response = await fetch('/capture');
     const blob = await response.blob();
     const img = document.getElementById('captured-img');
@@ -47,10 +69,82 @@ async function capture() {
     };
     img.style.display = 'block';
 
-    // fetch gesture name
-    const gestureResponse = await fetch('/gesture_name'); // endpoint returning detected class
-    const gestureName = await gestureResponse.text();
+    const gestureName = response.headers.get('X-Gesture');
+    const topK = (response.headers.get('X-Top-K') || '').replaceAll(',', ', ');
     document.getElementById('gesture-name').textContent = `Detected gesture: ${gestureName}`;
+    document.getElementById('details').textContent =
+        `frame ${response.headers.get('X-Frame-Id')}: ${topK}`;
+}
+
+// Every changed prediction is pushed over /events, without polling
+const events = new EventSource('/events');
+events.addEventListener('prediction', (e) => {
+    const p = JSON.parse(e.data);
+    document.getElementById('live').textContent =
+        `Live: ${p.gesture} (${(p.confidence * 100).toFixed(0)}%, frame ${p.frame_id})`;
+});
+
+// Live view: one long-lived multipart response from the stream server,
+// every part carries its gesture in the X-Gesture header
+const STREAM_PORT = )rawliteral" STRINGIFY(CONFIG_STREAM_PORT) R"rawliteral(;
+let streamReader = null;
+
+function show(jpeg, gesture) {
+    const img = document.getElementById('captured-img');
+    const old = img.src;
+    img.src = URL.createObjectURL(new Blob([jpeg], {type: 'image/jpeg'}));
+    img.onload = () => {
+        img.width = img.naturalWidth * 2;
+        img.height = img.naturalHeight * 2;
+        if (old.startsWith('blob:')) URL.revokeObjectURL(old);
+    };
+    img.style.display = 'block';
+    document.getElementById('gesture-name').textContent = `Detected gesture: ${gesture}`;
+}
+
+function headerEnd(buf) {
+    for (let i = 0; i + 3 < buf.length; i++) {
+        if (buf[i] == 13 && buf[i + 1] == 10 && buf[i + 2] == 13 && buf[i + 3] == 10) return i;
+    }
+    return -1;
+}
+
+async function toggleStream() {
+    const btn = document.getElementById('stream-btn');
+    if (streamReader) {
+        streamReader.cancel();
+        return;
+    }
+    const response = await fetch(`${location.protocol}//${location.hostname}:${STREAM_PORT}/stream`);
+    if (!response.ok) {
+        document.getElementById('gesture-name').textContent = `Live view unavailable: ${await response.text()}`;
+        return;
+    }
+    streamReader = response.body.getReader();
+    btn.textContent = 'Stop live view';
+    let buf = new Uint8Array(0);
+    try {
+        for (;;) {
+            const {value, done} = await streamReader.read();
+            if (done) break;
+            const joined = new Uint8Array(buf.length + value.length);
+            joined.set(buf);
+            joined.set(value, buf.length);
+            buf = joined;
+            for (;;) {
+                const end = headerEnd(buf);
+                if (end < 0) break;
+                const head = new TextDecoder().decode(buf.subarray(0, end));
+                const length = parseInt(/Content-Length: (\d+)/i.exec(head)[1]);
+                if (buf.length < end + 4 + length) break;
+                show(buf.slice(end + 4, end + 4 + length), /X-Gesture: (.*)/i.exec(head)[1]);
+                buf = buf.slice(end + 4 + length);
+            }
+        }
+    } catch (e) {
+    }
+    streamReader = null;
+    btn.textContent = 'Start live view';
 }
 </script>
 </body>
@@ -58,19 +152,627 @@ async function capture() {
 )rawliteral";
 
 
-const char* GESTURES[] = {"fist", "1 finger", "2 fingers", "3 fingers", "4 fingers", "palm", "phone", "mouth", "open mouth", "ok", "pinky", "rock1", "rock2", "stop"};
+const char* GESTURES[NUM_GESTURES] = {"fist", "1 finger", "2 fingers", "3 fingers", "4 fingers", "palm", "phone", "mouth", "open mouth", "ok", "pinky", "rock1", "rock2", "stop"};
+
+/**
+ * @brief Returns the name of a gesture class, or "unknown" for out-of-range indices.
+ */
+static const char* gesture_name(int index) {
+    return index >= 0 && index < (int)NUM_GESTURES ? GESTURES[index] : "unknown";
+}
+
+/**
+ * @brief Collects small writes into chunks for httpd_resp_send_chunk().
+ */
+class ChunkWriter {
+public:
+    explicit ChunkWriter(httpd_req_t *req) : req_(req) {}
+
+    /**
+     * @brief Appends printf-formatted text.
+     */
+    void printf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+        char line[160];
+        va_list args;
+        va_start(args, format);
+        int len = vsnprintf(line, sizeof(line), format, args);
+        va_end(args);
+        write(line, std::min<size_t>(std::max(len, 0), sizeof(line) - 1));
+    }
+
+    /**
+     * @brief Appends bytes, sending a chunk whenever the buffer is full.
+     *
+     * Blocks larger than the buffer are sent as their own chunk.
+     */
+    void write(const char *data, size_t len) {
+        if (used_ + len > sizeof(buffer_)) {
+            flush();
+        }
+        if (len > sizeof(buffer_)) {
+            send(data, len);
+            return;
+        }
+        memcpy(buffer_ + used_, data, len);
+        used_ += len;
+    }
+
+    /**
+     * @brief Checks that no send failed so far.
+     */
+    bool ok() const { return err_ == ESP_OK; }
+
+    /**
+     * @brief Returns the esp_timer time of the first chunk, or 0 if none was sent.
+     */
+    int64_t first_chunk_us() const { return first_chunk_us_; }
+
+    /**
+     * @brief Returns the size of the buffer, the most memory a response holds.
+     */
+    static constexpr size_t buffer_size() { return sizeof(buffer_); }
+
+    /**
+     * @brief Sends the remaining bytes and terminates the response.
+     *
+     * @return ESP_OK, or the first send error.
+     */
+    esp_err_t finish() {
+        flush();
+        if (err_ == ESP_OK) {
+            err_ = httpd_resp_send_chunk(req_, nullptr, 0);
+        }
+        return err_;
+    }
+
+private:
+    void flush() {
+        if (used_) {
+            send(buffer_, used_);
+        }
+        used_ = 0;
+    }
+
+    void send(const char *data, size_t len) {
+        if (err_ == ESP_OK) {
+            if (!first_chunk_us_) {
+                first_chunk_us_ = esp_timer_get_time();
+            }
+            err_ = httpd_resp_send_chunk(req_, data, len);
+        }
+    }
+
+    httpd_req_t *req_;      ///< The request answered.
+    char buffer_[1024];     ///< Pending bytes.
+    size_t used_ = 0;       ///< Number of pending bytes.
+    esp_err_t err_ = ESP_OK; ///< First send error.
+    int64_t first_chunk_us_ = 0; ///< esp_timer time of the first chunk.
+};
+
+
+/**
+ * @brief Prediction headers of a /capture response.
+ *
+ * httpd_resp_set_hdr() keeps pointers to the values until the response is
+ * sent, so they live here, next to the frame they describe.
+ */
+class PredictionHeaders {
+public:
+    static constexpr int kTopK = 3; ///< Number of classes in X-Top-K.
+
+    /**
+     * @brief Formats the headers of a prediction.
+     */
+    explicit PredictionHeaders(const Prediction& p) {
+        snprintf(frame_id_, sizeof(frame_id_), "%lu", (unsigned long)p.frame_id);
+        snprintf(confidence_, sizeof(confidence_), "%.3f", p.confidence);
+        snprintf(capture_us_, sizeof(capture_us_), "%lld", (long long)p.capture_us);
+        gesture_ = gesture_name(p.class_index);
+        reused_ = p.reused ? "1" : "0";
+
+        // Softmax probabilities of the k best classes, best first
+        int order[Prediction::kMaxScores];
+        const int n = std::min(p.num_scores, Prediction::kMaxScores);
+        for (int i = 0; i < n; i++) {
+            order[i] = i;
+        }
+        const int k = std::min(kTopK, n);
+        std::partial_sort(order, order + k, order + n, [&](int a, int b) { return p.scores[a] > p.scores[b]; });
+        float sum = 0.0f;
+        for (int i = 0; i < n; i++) {
+            sum += expf(p.scores[i] - p.scores[order[0]]);
+        }
+        int used = 0;
+        top_k_[0] = '\0';
+        for (int i = 0; i < k && used < (int)sizeof(top_k_); i++) {
+            used += snprintf(top_k_ + used, sizeof(top_k_) - used, "%s%s=%.3f", i ? "," : "",
+                             gesture_name(order[i]), expf(p.scores[order[i]] - p.scores[order[0]]) / sum);
+        }
+
+        // Server-Timing shows up in the browser's network panel
+        snprintf(timing_, sizeof(timing_), "preprocess;dur=%.2f, infer;dur=%.2f, encode;dur=%.2f, age;dur=%.2f",
+                 p.preprocess_us / 1000.0, p.inference_us / 1000.0, p.encode_us / 1000.0,
+                 (esp_timer_get_time() - p.capture_us) / 1000.0);
+    }
+
+    /**
+     * @brief Adds the headers to a response.
+     */
+    void set(httpd_req_t *req) const {
+        httpd_resp_set_hdr(req, "X-Frame-Id", frame_id_);
+        httpd_resp_set_hdr(req, "X-Gesture", gesture_);
+        httpd_resp_set_hdr(req, "X-Confidence", confidence_);
+        httpd_resp_set_hdr(req, "X-Top-K", top_k_);
+        httpd_resp_set_hdr(req, "X-Reused", reused_);
+        httpd_resp_set_hdr(req, "X-Capture-Us", capture_us_);
+        httpd_resp_set_hdr(req, "Server-Timing", timing_);
+    }
+
+private:
+    char frame_id_[12];
+    char confidence_[12];
+    char capture_us_[24];
+    char top_k_[kTopK * 32];
+    char timing_[128];
+    const char *gesture_;
+    const char *reused_;
+};
+
+
+/// How /capture produced its JPEG.
+enum class CaptureMode { Cached, Buffered, Streamed, kCount };
+
+/**
+ * @brief Time-to-first-byte, response time and memory of /capture responses.
+ */
+struct CaptureStats {
+    uint32_t responses = 0;      ///< Successful responses.
+    int64_t total_ttfb_us = 0;   ///< Sum of the times from request to first byte sent.
+    int64_t max_ttfb_us = 0;     ///< Longest time from request to first byte sent.
+    int64_t total_us = 0;        ///< Sum of the times from request to last byte sent.
+    int64_t max_us = 0;          ///< Longest time from request to last byte sent.
+    size_t max_buffer_bytes = 0; ///< Largest JPEG output buffer a response held.
+};
+
+static std::mutex capture_stats_mutex;
+static CaptureStats capture_stats[static_cast<int>(CaptureMode::kCount)];
+
+static void record_capture(CaptureMode mode, int64_t ttfb_us, int64_t response_us, size_t buffer_bytes) {
+    std::lock_guard<std::mutex> lock(capture_stats_mutex);
+    CaptureStats& s = capture_stats[static_cast<int>(mode)];
+    s.responses++;
+    s.total_ttfb_us += ttfb_us;
+    s.max_ttfb_us = std::max(s.max_ttfb_us, ttfb_us);
+    s.total_us += response_us;
+    s.max_us = std::max(s.max_us, response_us);
+    s.max_buffer_bytes = std::max(s.max_buffer_bytes, buffer_bytes);
+}
+
+
+/**
+ * @brief Counters of /stream sessions.
+ */
+struct StreamStats {
+    uint32_t clients = 0;        ///< Streams currently open.
+    uint32_t sessions = 0;       ///< Streams opened since boot.
+    uint32_t rejected = 0;       ///< Streams refused because another viewer was streaming.
+    uint32_t parts = 0;          ///< Frames sent.
+    uint32_t skipped_slots = 0;  ///< Frame slots dropped because sending fell behind.
+    uint32_t unsent_frames = 0;  ///< Published frames no stream part carried.
+    uint64_t bytes = 0;          ///< JPEG bytes sent.
+    int64_t total_send_us = 0;   ///< Sum of the times spent sending parts.
+    int64_t max_send_us = 0;     ///< Longest time spent sending a part.
+};
+
+static std::mutex stream_stats_mutex;
+static StreamStats stream_stats;
+
+
+/**
+ * @brief A client of /events.
+ */
+struct SseClient {
+    static constexpr size_t kMaxRecord = 256; ///< Largest record, including its chunk framing.
+
+    int fd = -1;                 ///< Socket, -1 if the slot is free.
+    bool ready = false;          ///< The response headers went out, records may follow.
+    bool closing = false;        ///< A close was triggered.
+    uint32_t last_id = 0;        ///< Frame id of the last record queued to the client.
+    char pending[kMaxRecord];    ///< The record being sent.
+    size_t pending_len = 0;      ///< Length of the record being sent.
+    size_t pending_sent = 0;     ///< Bytes of it already sent.
+    int64_t stalled_since_us = 0; ///< When the client stopped taking bytes, 0 if it keeps up.
+};
+
+/**
+ * @brief Counters of /events.
+ */
+struct SseStats {
+    uint32_t clients = 0;        ///< Connected clients.
+    uint32_t connections = 0;    ///< Clients connected since boot.
+    uint32_t rejected = 0;       ///< Clients turned away because all slots were taken.
+    uint32_t records = 0;        ///< Records formatted, one per changed prediction.
+    uint32_t delivered = 0;      ///< Records completely sent to a client.
+    uint32_t skipped = 0;        ///< Records a client missed because it was still busy with an older one.
+    uint32_t backpressure = 0;   ///< Records that did not fit into the client's socket at once.
+    uint32_t stalled = 0;        ///< Clients closed because they stopped taking bytes.
+};
+
+static constexpr int64_t kSseStallTimeoutUs = 5000000;
+static constexpr int64_t kSseKeepAliveUs = 15000000;
+
+static std::mutex sse_mutex; ///< Guards sse_clients and sse_stats.
+static SseClient sse_clients[CONFIG_SSE_MAX_CLIENTS];
+static SseStats sse_stats;
+static httpd_handle_t main_server = nullptr; ///< The server owning the client sockets.
+
+/**
+ * @brief Sends as much of a client's pending record as its socket takes without blocking.
+ *
+ * The caller must hold sse_mutex.
+ */
+static void sse_flush(SseClient& c, int64_t now) {
+    const bool had_pending = c.pending_sent < c.pending_len;
+    while (c.pending_sent < c.pending_len) {
+        ssize_t n = send(c.fd, c.pending + c.pending_sent, c.pending_len - c.pending_sent, MSG_DONTWAIT);
+        if (n > 0) {
+            c.pending_sent += n;
+        } else {
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && !c.closing) {
+                c.closing = true;
+                httpd_sess_trigger_close(main_server, c.fd);
+            }
+            break;
+        }
+    }
+
+    if (c.pending_sent < c.pending_len) {
+        if (!c.stalled_since_us) {
+            c.stalled_since_us = now;
+            sse_stats.backpressure++;
+        } else if (now - c.stalled_since_us > kSseStallTimeoutUs && !c.closing) {
+            ESP_LOGW(TAG, "Closing stalled event client %d", c.fd);
+            c.closing = true;
+            sse_stats.stalled++;
+            httpd_sess_trigger_close(main_server, c.fd);
+        }
+    } else {
+        if (had_pending) {
+            sse_stats.delivered++;
+        }
+        c.stalled_since_us = 0;
+    }
+}
+
+/**
+ * @brief Queues a chunk-framed record to a client whose last record is sent.
+ */
+static void sse_queue(SseClient& c, const char* record, size_t len) {
+    memcpy(c.pending, record, len);
+    c.pending_len = len;
+    c.pending_sent = 0;
+}
+
+/**
+ * @brief Pushes every changed prediction to the /events clients.
+ *
+ * Every record is formatted once for all clients. A client that cannot take
+ * it at once keeps the rest of that one record and skips the ones published
+ * meanwhile, and gets the newest record once it has caught up, so a slow
+ * client neither blocks the others nor makes memory grow.
+ */
+static void sse_task(void* arg) {
+    uint32_t seen = frames_published();
+    char record[SseClient::kMaxRecord];
+    size_t record_len = 0;
+    uint32_t record_id = 0;
+    int last_class = -2;
+    long last_confidence = -1;
+    int64_t keepalive_at = esp_timer_get_time() + kSseKeepAliveUs;
+    bool busy = false;
+
+    while (true) {
+        std::shared_ptr<const InferenceFrame> frame = wait_for_frame(seen, busy ? 10 : 100);
+        bool fresh = false;
+        if (frame) {
+            // Only changes are pushed, e.g. not the frames the motion gate reused
+            const Prediction& p = frame->prediction;
+            long confidence = lroundf(p.confidence * 1000);
+            if (p.class_index != last_class || confidence != last_confidence) {
+                char data[200];
+                int len = snprintf(data, sizeof(data),
+                                   "id: %lu\nevent: prediction\ndata: {\"frame_id\":%lu,\"class\":%d,"
+                                   "\"gesture\":\"%s\",\"confidence\":%.3f,\"capture_us\":%lld,"
+                                   "\"published_us\":%lld}\n\n",
+                                   (unsigned long)p.frame_id, (unsigned long)p.frame_id, p.class_index,
+                                   gesture_name(p.class_index), p.confidence, (long long)p.capture_us,
+                                   (long long)p.published_us);
+                len = std::min<int>(len, sizeof(data) - 1);
+                record_len = snprintf(record, sizeof(record), "%x\r\n%.*s\r\n", len, len, data);
+                record_id = p.frame_id;
+                last_class = p.class_index;
+                last_confidence = confidence;
+                fresh = true;
+            }
+        }
+
+        const int64_t now = esp_timer_get_time();
+        const bool keepalive = now >= keepalive_at;
+        if (keepalive) {
+            keepalive_at = now + kSseKeepAliveUs;
+        }
+        static const char kKeepAlive[] = "d\r\n: keepalive\n\n\r\n";
+
+        std::lock_guard<std::mutex> lock(sse_mutex);
+        sse_stats.records += fresh;
+        busy = false;
+        for (SseClient& c : sse_clients) {
+            if (c.fd < 0 || !c.ready || c.closing) {
+                continue;
+            }
+            if (c.pending_sent == c.pending_len) {
+                if (record_len && c.last_id != record_id) {
+                    sse_queue(c, record, record_len);
+                    c.last_id = record_id;
+                } else if (keepalive) {
+                    sse_queue(c, kKeepAlive, sizeof(kKeepAlive) - 1);
+                }
+            } else if (fresh) {
+                sse_stats.skipped++;
+            }
+            sse_flush(c, now);
+            busy |= c.pending_sent < c.pending_len;
+        }
+    }
+}
+
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+/**
+ * @brief A client of /ws.
+ */
+struct WsClient {
+    int fd = -1;                ///< Socket, -1 if the slot is free.
+    int fps = CONFIG_STREAM_FPS; ///< Requested message rate.
+    bool jpeg = true;           ///< Send the JPEG after the header.
+    bool in_flight = false;     ///< A message is queued or being sent.
+    uint32_t last_id = 0;       ///< Frame id of the last message.
+    int64_t next_us = 0;        ///< Earliest time of the next message.
+    uint32_t id = 0;            ///< Connection number, tells a new client on a reused fd apart.
+};
+
+/**
+ * @brief A message queued to a /ws client, owned by the server's send work until it completes.
+ */
+struct WsMessage {
+    int fd;                  ///< Socket of the client.
+    uint32_t client_id;      ///< WsClient::id of the client.
+    WsFrameHeader header;    ///< The header fragment's payload.
+    std::shared_ptr<const InferenceFrame> frame; ///< Keeps the JPEG alive until it is sent.
+};
+
+/**
+ * @brief Counters of /ws.
+ */
+struct WsStats {
+    uint32_t clients = 0;       ///< Connected clients.
+    uint32_t connections = 0;   ///< Clients connected since boot.
+    uint32_t rejected = 0;      ///< Clients turned away because all slots were taken.
+    uint32_t messages = 0;      ///< Messages sent.
+    uint32_t failed = 0;        ///< Messages that could not be sent.
+    uint32_t busy_skips = 0;    ///< Due frames skipped because the last message was still in flight.
+    uint32_t controls = 0;      ///< Control messages received.
+    uint64_t bytes = 0;         ///< Header and JPEG bytes sent.
+};
+
+static std::mutex ws_mutex; ///< Guards ws_clients and ws_stats.
+static WsClient ws_clients[CONFIG_WS_MAX_CLIENTS];
+static WsStats ws_stats;
+
+/**
+ * @brief Completes a message: frees it and lets its client take the next one.
+ *
+ * A failed send may have left part of a message on the socket, after which
+ * the client cannot parse the stream anymore, so the session is closed.
+ */
+static void ws_finish(WsMessage* m, esp_err_t err) {
+    bool connected = false;
+    {
+        std::lock_guard<std::mutex> lock(ws_mutex);
+        for (WsClient& c : ws_clients) {
+            if (c.fd == m->fd && c.id == m->client_id) {
+                c.in_flight = false;
+                connected = true;
+            }
+        }
+        if (err == ESP_OK) {
+            ws_stats.messages++;
+            ws_stats.bytes += sizeof(WsFrameHeader) + m->header.jpeg_len;
+        } else {
+            ws_stats.failed++;
+        }
+    }
+    // A client that already left may have handed its fd to a new session
+    if (err != ESP_OK && connected) {
+        ESP_LOGW(TAG, "Closing /ws client %d after a failed send: %s", m->fd, esp_err_to_name(err));
+        httpd_sess_trigger_close(main_server, m->fd);
+    }
+    delete m;
+}
+
+/**
+ * @brief Called by the server once the JPEG fragment went out.
+ */
+static void ws_image_sent(esp_err_t err, int socket, void *arg) {
+    ws_finish(static_cast<WsMessage*>(arg), err);
+}
+
+/**
+ * @brief Called by the server once the header went out: queues the JPEG fragment, if any.
+ *
+ * The continuation is only queued after the header was sent, so it never goes
+ * out on its own.
+ */
+static void ws_header_sent(esp_err_t err, int socket, void *arg) {
+    WsMessage* m = static_cast<WsMessage*>(arg);
+    if (err == ESP_OK && m->header.jpeg_len > 0) {
+        httpd_ws_frame_t image = {};
+        image.type = HTTPD_WS_TYPE_CONTINUE;
+        image.payload = m->frame->jpeg->buf;
+        image.len = m->header.jpeg_len;
+        image.fragmented = true;
+        image.final = true;
+        err = httpd_ws_send_data_async(main_server, m->fd, &image, ws_image_sent, m);
+        if (err == ESP_OK) {
+            return;
+        }
+    }
+    ws_finish(m, err);
+}
+
+/**
+ * @brief Queues the message of a frame to a client.
+ *
+ * The header and the JPEG go out as two fragments of one binary message, so
+ * the JPEG is sent from the frame without copying. The message owns the
+ * header and a reference to the frame until the server completes it, even if
+ * the client disconnects meanwhile. The caller must hold ws_mutex.
+ */
+static void ws_send(WsClient& c, std::shared_ptr<const InferenceFrame> frame, int64_t now) {
+    const Prediction& p = frame->prediction;
+    const camera_fb_t* jpeg_fb = c.jpeg ? frame->jpeg.get() : nullptr;
+    WsMessage* m = new (std::nothrow) WsMessage{c.fd, c.id, {}, std::move(frame)};
+    if (!m) {
+        ws_stats.failed++;
+        return;
+    }
+    WsFrameHeader& h = m->header;
+    h.version = WsFrameHeader::kVersion;
+    h.flags = p.reused ? WsFrameHeader::kReused : 0;
+    h.class_index = p.class_index;
+    h.num_scores = std::min<int>(p.num_scores, 16);
+    h.frame_id = p.frame_id;
+    h.confidence = p.confidence;
+    h.capture_us = p.capture_us;
+    h.preprocess_us = p.preprocess_us;
+    h.inference_us = p.inference_us;
+    h.encode_us = p.encode_us;
+    h.age_us = now - p.capture_us;
+    h.jpeg_len = jpeg_fb ? jpeg_fb->len : 0;
+    memcpy(h.scores, p.scores, h.num_scores * sizeof(float));
+
+    httpd_ws_frame_t header = {};
+    header.type = HTTPD_WS_TYPE_BINARY;
+    header.payload = reinterpret_cast<uint8_t*>(&h);
+    header.len = sizeof(h);
+    header.fragmented = jpeg_fb != nullptr;
+    header.final = jpeg_fb == nullptr;
+    if (httpd_ws_send_data_async(main_server, c.fd, &header, ws_header_sent, m) != ESP_OK) {
+        // Nothing was queued, the stream is still intact
+        ws_stats.failed++;
+        delete m;
+        return;
+    }
+    c.in_flight = true;
+    c.last_id = h.frame_id;
+}
+
+/**
+ * @brief Pushes new frames to the /ws clients at their requested rates.
+ */
+static void ws_task(void* arg) {
+    uint32_t seen = frames_published();
+    while (true) {
+        std::shared_ptr<const InferenceFrame> frame = wait_for_frame(seen, 100);
+        if (!frame) {
+            frame = latest_frame(); // a client may have become due without a new frame
+        }
+        if (!frame) {
+            continue;
+        }
+
+        const int64_t now = esp_timer_get_time();
+        std::lock_guard<std::mutex> lock(ws_mutex);
+        for (WsClient& c : ws_clients) {
+            if (c.fd < 0 || c.last_id == frame->prediction.frame_id || now < c.next_us) {
+                continue;
+            }
+            if (c.in_flight) {
+                ws_stats.busy_skips++;
+                continue;
+            }
+            // Never catch up on missed slots, the rate is an upper bound
+            c.next_us = std::max(c.next_us + 1000000 / c.fps, now);
+            ws_send(c, frame, now);
+        }
+    }
+}
+#endif
+
+
+/**
+ * @brief Closes a session of the main server and forgets it if it was an /events or /ws client.
+ */
+static void close_session(httpd_handle_t hd, int sockfd) {
+    {
+        std::lock_guard<std::mutex> lock(sse_mutex);
+        for (SseClient& c : sse_clients) {
+            if (c.fd == sockfd) {
+                c = SseClient();
+                sse_stats.clients--;
+            }
+        }
+    }
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    {
+        std::lock_guard<std::mutex> lock(ws_mutex);
+        for (WsClient& c : ws_clients) {
+            if (c.fd == sockfd) {
+                c = WsClient();
+                ws_stats.clients--;
+            }
+        }
+    }
+#endif
+    close(sockfd);
+}
+
 
 esp_err_t index_handler(httpd_req_t *req) {
+    TRACE_FUNCTION();
     httpd_resp_set_type(req, "text/html");
     return httpd_resp_send(req, MAIN_PAGE, strlen(MAIN_PAGE));
 }
 
+/**
+ * @brief Registered for the slow endpoints: runs their handler on an HttpWorkers task.
+ */
+template <HttpWorkers::Handler handler>
+static esp_err_t on_worker(httpd_req_t *req) {
+    return HttpWorkers::submit(req, handler);
+}
+
 esp_err_t startServer(httpd_handle_t &server, void* model_ctx) {
     ESP_LOGI(TAG, "Wifi: Starting server...");
 
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.max_uri_handlers = 16;
+    config.max_resp_headers = 12; // /capture sends the prediction in headers
+    config.close_fn = close_session; // forgets /events clients
+    // Long-lived /events and /ws clients and requests parked on workers keep their sockets
+    config.max_open_sockets = 10;
+
+    if (HttpWorkers::start() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start the HTTP workers");
+        return ESP_FAIL;
+    }
 
     if (httpd_start(&server, &config) == ESP_OK) {
+        httpd_uri_t trace_uri = {
+            .uri = "/trace",
+            .method = HTTP_GET,
+            .handler = trace_handler,
+            .user_ctx = NULL};
+
         httpd_uri_t index_uri = {
             .uri = "/",
             .method = HTTP_GET,
@@ -80,7 +782,7 @@ esp_err_t startServer(httpd_handle_t &server, void* model_ctx) {
         httpd_uri_t capture_uri = {
             .uri = "/capture",
             .method = HTTP_GET,
-            .handler = capture_handler,
+            .handler = on_worker<capture_handler>,
             .user_ctx = model_ctx};
 
         httpd_uri_t gesture_name_uri = {
@@ -89,100 +791,1123 @@ esp_err_t startServer(httpd_handle_t &server, void* model_ctx) {
             .handler = gesture_name_handler,
             .user_ctx = model_ctx};
 
+        httpd_uri_t profile_uri = {
+            .uri = "/profile",
+            .method = HTTP_GET,
+            .handler = on_worker<profile_handler>,
+            .user_ctx = model_ctx};
+
+        httpd_uri_t prediction_uri = {
+            .uri = "/prediction",
+            .method = HTTP_GET,
+            .handler = prediction_handler,
+            .user_ctx = model_ctx};
+
+        httpd_uri_t predict_uri = {
+            .uri = "/predict",
+            .method = HTTP_POST,
+            .handler = on_worker<predict_handler>,
+            .user_ctx = model_ctx};
+
+        httpd_uri_t pipeline_uri = {
+            .uri = "/pipeline",
+            .method = HTTP_GET,
+            .handler = pipeline_handler,
+            .user_ctx = NULL};
+
         httpd_register_uri_handler(server, &index_uri);
         httpd_register_uri_handler(server, &capture_uri);
         httpd_register_uri_handler(server, &gesture_name_uri);
-        return ESP_OK;
+        httpd_register_uri_handler(server, &profile_uri);
+        httpd_register_uri_handler(server, &prediction_uri);
+        httpd_register_uri_handler(server, &predict_uri);
+        httpd_register_uri_handler(server, &pipeline_uri);
+        httpd_register_uri_handler(server, &trace_uri);
+        httpd_uri_t sse_uri = {
+            .uri = "/events",
+            .method = HTTP_GET,
+            .handler = sse_handler,
+            .user_ctx = NULL};
+        httpd_register_uri_handler(server, &sse_uri);
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+        httpd_uri_t ws_uri = {
+            .uri = "/ws",
+            .method = HTTP_GET,
+            .handler = ws_handler,
+            .user_ctx = NULL,
+            .is_websocket = true};
+        httpd_register_uri_handler(server, &ws_uri);
+#endif
+#ifdef CONFIG_EVENT_TRACE
+        httpd_uri_t events_uri = {
+            .uri = "/events.json",
+            .method = HTTP_GET,
+            .handler = on_worker<events_handler>,
+            .user_ctx = NULL};
+        httpd_register_uri_handler(server, &events_uri);
+#endif
     } else {
         return ESP_FAIL;
     }
-}
 
-esp_err_t capture_handler(httpd_req_t *req) {
-    camera_fb_t *fb = esp_camera_fb_get();
-    if (!fb) {
-        httpd_resp_send_500(req);
+    main_server = server;
+    if (xTaskCreatePinnedToCore(sse_task, "sse", 3072, NULL, config.task_priority, NULL, config.core_id) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start the event task");
+        return ESP_FAIL;
+    }
+
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    if (xTaskCreatePinnedToCore(ws_task, "ws", 3072, NULL, config.task_priority, NULL, config.core_id) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start the WebSocket task");
+        return ESP_FAIL;
+    }
+#endif
+
+    // A stream holds its socket for as long as the client watches; the second one turns away other viewers
+    httpd_config_t stream_config = HTTPD_DEFAULT_CONFIG();
+    stream_config.server_port = CONFIG_STREAM_PORT;
+    stream_config.ctrl_port = config.ctrl_port + 1;
+    stream_config.max_uri_handlers = 1;
+    stream_config.max_open_sockets = 2;
+    httpd_handle_t stream_server = NULL;
+    if (httpd_start(&stream_server, &stream_config) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start the stream server on port %d", CONFIG_STREAM_PORT);
         return ESP_FAIL;
     }
+    httpd_uri_t stream_uri = {
+        .uri = "/stream",
+        .method = HTTP_GET,
+        .handler = stream_handler,
+        .user_ctx = model_ctx};
+    httpd_register_uri_handler(stream_server, &stream_uri);
+    return ESP_OK;
+}
+
+esp_err_t capture_handler(httpd_req_t *req) {
+    TRACE_FUNCTION();
+    int64_t request_us = esp_timer_get_time();
 
     // Retrieve the model from the user context
     TFLiteModel* model = static_cast<TFLiteModel*>(req->user_ctx);
     if (!model || !model->is_initialized()) {
         ESP_LOGE(TAG, "Model not initialized or not passed in context");
         httpd_resp_send_500(req);
-        esp_camera_fb_return(fb);
         return ESP_FAIL;
     }
 
-    // Get model input tensor and dimensions
-    // Could add validation in capture_handler():
-    if (model->input()->type != kTfLiteFloat32) {
-        ESP_LOGE(TAG, "Wrong input tensor type");
+    // With continuous inference only read the latest result, otherwise capture and predict
+    // now, together with the concurrent requests
+    std::shared_ptr<const InferenceFrame> frame =
+        InferencePipeline::is_running() ? latest_frame() : capture_shared(model);
+
+    if (!frame) {
+        httpd_resp_send_500(req);
         return ESP_FAIL;
     }
-    
-    float *model_input = model->input()->data.f;
-    
-    TfLiteIntArray* input_dims = model->input()->dims;
-    size_t model_input_width = input_dims->data[2];
-    size_t model_input_height = input_dims->data[3];
+    ESP_LOGI(TAG, "DETECTED GESTURE: %s (frame %lu)", gesture_name(frame->prediction.class_index),
+             (unsigned long)frame->prediction.frame_id);
 
-    ESP_LOGI(TAG, "Model input dims %d %d", model_input_width, model_input_height);
+    FrameTrace trace = frame->prediction.trace;
+    trace.set(TracePoint::Request, request_us);
 
-    resize_and_normalize_grayscale(fb->buf, fb->width, fb->height, model_input,
-                                   model_input_width, model_input_height);
+    // Display in the web GUI, the pipeline has usually encoded the JPEG already.
+    // ?encode=stream or ?encode=buffer re-encode it, to compare both paths.
+    CaptureMode mode = frame->jpeg ? CaptureMode::Cached : CaptureMode::Streamed;
+    char query[32];
+    char value[8];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "encode", value, sizeof(value)) == ESP_OK) {
+        mode = strcmp(value, "buffer") == 0 ? CaptureMode::Buffered : CaptureMode::Streamed;
+    }
 
-    // Predict gesture
-    if (model->invoke() != kTfLiteOk) {
-        ESP_LOGE(TAG, "Cannot invoke interpreter");
+    // The headers come from the same frame as the image, so they always match it
+    httpd_resp_set_type(req, "image/jpeg");
+    PredictionHeaders headers(frame->prediction);
+    headers.set(req);
+    int64_t first_byte_us = 0;
+    size_t buffer_bytes = 0;
+    esp_err_t err = ESP_OK;
+    if (mode == CaptureMode::Streamed) {
+        // Every block goes to the socket as soon as the encoder produces it
+        camera_fb_t fb = frame->as_fb();
+        ChunkWriter out(req);
+        trace.mark(TracePoint::EncodeStart);
+        bool encoded = encode_grayscale_jpeg(&fb, [](void *arg, size_t index, const void *data, size_t len) {
+            ChunkWriter *out = static_cast<ChunkWriter*>(arg);
+            out->write(static_cast<const char*>(data), len);
+            return out->ok() ? len : 0;
+        }, &out);
+        trace.mark(TracePoint::EncodeEnd);
+        trace.set(TracePoint::ResponseStart, out.first_chunk_us());
+        if (!encoded) {
+            ESP_LOGE(TAG, "Failed to stream JPEG");
+            if (!out.first_chunk_us()) {
+                httpd_resp_send_500(req);
+            } // Otherwise too late for a 500, the client sees a truncated image
+            return ESP_FAIL;
+        }
+        err = out.finish();
+        first_byte_us = out.first_chunk_us();
+        buffer_bytes = ChunkWriter::buffer_size();
     } else {
-        TfLiteTensor *output = model->output();
-        float *logits = output->data.f;
+        const camera_fb_t* jpeg_fb = frame->jpeg.get();
+        std::unique_ptr<camera_fb_t, CameraFbDeleter> encoded;
+        if (mode == CaptureMode::Buffered) {
+            trace.mark(TracePoint::EncodeStart);
+            camera_fb_t fb = frame->as_fb();
+            encoded = convert_grayscale_to_jpeg(&fb);
+            jpeg_fb = encoded.get();
+            trace.mark(TracePoint::EncodeEnd);
+            buffer_bytes = jpeg_fb ? std::max(jpeg_fb->len, JpegPool::getInstance().buffer_size()) : 0;
+        }
+
+        if (!jpeg_fb) {
+            ESP_LOGE(TAG, "Failed to convert to JPEG");
+            httpd_resp_send_500(req);
+            return ESP_FAIL;
+        }
 
-        float max = logits[0];
-        uint argmax = 0;
-        
-        for (int i = 0; i < output->dims->data[1]; i++) {
-            ESP_LOGI(TAG, "Logit %d: %f", i, logits[i]);
-            if (logits[i] > max) {
-                max = logits[i];
-                argmax = i;
+        trace.mark(TracePoint::ResponseStart);
+        first_byte_us = trace.get(TracePoint::ResponseStart);
+        err = httpd_resp_send(req, (const char *)jpeg_fb->buf, jpeg_fb->len);
+    }
+    trace.mark(TracePoint::ResponseEnd);
+    ESP_LOGI(TAG, "Camera: handle capture request");
+
+    if (err == ESP_OK) {
+        record_capture(mode, first_byte_us - request_us, trace.get(TracePoint::ResponseEnd) - request_us,
+                       buffer_bytes);
+    }
+    if (LatencyTraceRing* traces = latency_traces()) {
+        traces->push(trace);
+    }
+    return err;
+}
+
+#define STREAM_BOUNDARY "gesture-frame"
+
+/**
+ * @brief Sends the parts of a stream until the client disconnects.
+ *
+ * @param req The detached request.
+ * @param model The initialized model.
+ */
+static esp_err_t stream_session(httpd_req_t *req, TFLiteModel* model) {
+    int fps = CONFIG_STREAM_FPS;
+    char query[32];
+    char value[8];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "fps", value, sizeof(value)) == ESP_OK) {
+        fps = std::min(std::max(atoi(value), 1), 30);
+    }
+    const int64_t interval_us = 1000000 / fps;
+
+    httpd_resp_set_type(req, "multipart/x-mixed-replace;boundary=" STREAM_BOUNDARY);
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*"); // the page is served from the main port
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    ESP_LOGI(TAG, "Stream opened at %d fps", fps);
+
+    esp_err_t err = ESP_OK;
+    uint32_t last_id = 0;
+    int64_t next_us = esp_timer_get_time();
+    while (err == ESP_OK) {
+        int64_t now = esp_timer_get_time();
+        if (now < next_us) {
+            vTaskDelay(std::max<TickType_t>(1, pdMS_TO_TICKS((next_us - now + 999) / 1000)));
+        }
+
+        // Slots missed while the last part was sent are dropped, never queued
+        uint32_t missed = std::max<int64_t>(esp_timer_get_time() - next_us, 0) / interval_us;
+        next_us += (missed + 1) * interval_us;
+
+        std::shared_ptr<const InferenceFrame> frame =
+            InferencePipeline::is_running() ? latest_frame() : capture_shared(model);
+        if (!frame || frame->prediction.frame_id == last_id) {
+            std::lock_guard<std::mutex> lock(stream_stats_mutex);
+            stream_stats.skipped_slots += missed;
+            continue; // Nothing new yet, wait for the next slot
+        }
+
+        TRACE_SCOPE("stream_part");
+        const int64_t start_us = esp_timer_get_time();
+        const Prediction& p = frame->prediction;
+        const camera_fb_t* jpeg_fb = frame->jpeg.get();
+        std::unique_ptr<camera_fb_t, CameraFbDeleter> encoded;
+        if (!jpeg_fb) {
+            camera_fb_t fb = frame->as_fb();
+            encoded = convert_grayscale_to_jpeg(&fb);
+            jpeg_fb = encoded.get();
+        }
+        if (!jpeg_fb) {
+            ESP_LOGE(TAG, "Failed to convert to JPEG");
+            err = ESP_FAIL;
+            break;
+        }
+
+        char header[256];
+        int len = snprintf(header, sizeof(header),
+                           "--" STREAM_BOUNDARY "\r\n"
+                           "Content-Type: image/jpeg\r\n"
+                           "Content-Length: %u\r\n"
+                           "X-Frame-Id: %lu\r\n"
+                           "X-Gesture: %s\r\n"
+                           "X-Confidence: %.3f\r\n"
+                           "X-Reused: %d\r\n"
+                           "X-Capture-Us: %lld\r\n\r\n",
+                           (unsigned)jpeg_fb->len, (unsigned long)p.frame_id, gesture_name(p.class_index),
+                           p.confidence, p.reused, (long long)p.capture_us);
+        err = httpd_resp_send_chunk(req, header, len);
+        if (err == ESP_OK) {
+            err = httpd_resp_send_chunk(req, (const char *)jpeg_fb->buf, jpeg_fb->len);
+        }
+        if (err == ESP_OK) {
+            err = httpd_resp_send_chunk(req, "\r\n", 2);
+        }
+
+        const int64_t send_us = esp_timer_get_time() - start_us;
+        std::lock_guard<std::mutex> lock(stream_stats_mutex);
+        stream_stats.skipped_slots += missed;
+        if (err == ESP_OK) {
+            stream_stats.parts++;
+            stream_stats.bytes += jpeg_fb->len;
+            stream_stats.total_send_us += send_us;
+            stream_stats.max_send_us = std::max(stream_stats.max_send_us, send_us);
+            if (last_id && p.frame_id > last_id + 1) {
+                stream_stats.unsent_frames += p.frame_id - last_id - 1;
             }
         }
-        ESP_LOGI(TAG, "DETECTED GESTURE: %s", GESTURES[argmax]);
-        
-        model->set_last_detected_index(argmax);
+        last_id = p.frame_id;
+    }
+
+    ESP_LOGI(TAG, "Stream closed");
+    return err;
+}
 
+
+/**
+ * @brief Task running one stream, so the stream server task stays free to turn away other viewers.
+ *
+ * @param arg The detached request.
+ */
+static void stream_task(void* arg) {
+    httpd_req_t* req = static_cast<httpd_req_t*>(arg);
+    stream_session(req, static_cast<TFLiteModel*>(req->user_ctx));
+    httpd_req_async_handler_complete(req);
+    {
+        std::lock_guard<std::mutex> lock(stream_stats_mutex);
+        stream_stats.clients--;
     }
+    vTaskDelete(nullptr);
+}
 
-    std::unique_ptr<camera_fb_t, CameraFbDeleter> jpeg_fb = nullptr;
-    
-    // Display in the web GUI
-    jpeg_fb = convert_grayscale_to_jpeg(fb);
-    
-    if (!jpeg_fb) {
-        ESP_LOGE(TAG, "Failed to convert to JPEG");
+
+esp_err_t stream_handler(httpd_req_t *req) {
+    TFLiteModel* model = static_cast<TFLiteModel*>(req->user_ctx);
+    if (!model || !model->is_initialized()) {
         httpd_resp_send_500(req);
-    } else {
-        httpd_resp_set_type(req, "image/jpeg");
-        httpd_resp_send(req, (const char *)jpeg_fb->buf, jpeg_fb->len);
+        return ESP_FAIL;
     }
 
-    esp_camera_fb_return(fb);
-    ESP_LOGI(TAG, "Camera: handle capture request");
+    // One viewer at a time: every stream sends its own JPEGs over the same Wi-Fi
+    bool busy;
+    {
+        std::lock_guard<std::mutex> lock(stream_stats_mutex);
+        busy = stream_stats.clients > 0;
+        if (busy) {
+            stream_stats.rejected++;
+        } else {
+            stream_stats.clients++;
+            stream_stats.sessions++;
+        }
+    }
+    if (busy) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "5");
+        httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+        httpd_resp_sendstr(req, "Another viewer is streaming");
+        return ESP_FAIL; // Closes the socket, the server has only one besides the stream's
+    }
+
+    httpd_req_t* detached = nullptr;
+    esp_err_t err = httpd_req_async_handler_begin(req, &detached);
+    if (err != ESP_OK) {
+        httpd_resp_send_500(req);
+    } else if (xTaskCreate(stream_task, "stream", 6144, detached, tskIDLE_PRIORITY + 5, nullptr) != pdPASS) {
+        httpd_resp_send_500(detached);
+        httpd_req_async_handler_complete(detached);
+        err = ESP_ERR_NO_MEM;
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Cannot start stream: %s", esp_err_to_name(err));
+        std::lock_guard<std::mutex> lock(stream_stats_mutex);
+        stream_stats.clients--;
+    }
+    return err;
+}
+
+esp_err_t sse_handler(httpd_req_t *req) {
+    TRACE_FUNCTION();
+    const int fd = httpd_req_to_sockfd(req);
+    SseClient* client = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(sse_mutex);
+        for (SseClient& c : sse_clients) {
+            if (c.fd < 0) {
+                client = &c;
+                c.fd = fd; // reserved, records follow once ready
+                sse_stats.clients++;
+                sse_stats.connections++;
+                break;
+            }
+        }
+        sse_stats.rejected += client == nullptr;
+    }
+    if (!client) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_sendstr(req, "Too many event clients");
+    }
+
+    // Headers and a first chunk; the socket then belongs to sse_task until the client leaves
+    httpd_resp_set_type(req, "text/event-stream");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    static const char kHello[] = "retry: 2000\n\n";
+    esp_err_t err = httpd_resp_send_chunk(req, kHello, sizeof(kHello) - 1);
+
+    std::lock_guard<std::mutex> lock(sse_mutex);
+    if (client->fd == fd) {
+        client->ready = err == ESP_OK;
+    }
+    return err;
+}
+
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+esp_err_t ws_handler(httpd_req_t *req) {
+    TRACE_FUNCTION();
+    const int fd = httpd_req_to_sockfd(req);
+    if (req->method == HTTP_GET) {
+        // Handshake done, the sender task takes over
+        std::lock_guard<std::mutex> lock(ws_mutex);
+        for (WsClient& c : ws_clients) {
+            if (c.fd < 0) {
+                c = WsClient();
+                c.fd = fd;
+                c.id = ++ws_stats.connections;
+                ws_stats.clients++;
+                return ESP_OK;
+            }
+        }
+        ws_stats.rejected++;
+        return ESP_FAIL;
+    }
+
+    // Control message, e.g. {"fps": 5, "jpeg": false}
+    uint8_t buf[128];
+    httpd_ws_frame_t message = {};
+    esp_err_t err = httpd_ws_recv_frame(req, &message, 0);
+    if (err != ESP_OK || message.len >= sizeof(buf)) {
+        return err != ESP_OK ? err : ESP_ERR_INVALID_SIZE;
+    }
+    message.payload = buf;
+    err = httpd_ws_recv_frame(req, &message, sizeof(buf));
+    if (err != ESP_OK || message.type != HTTPD_WS_TYPE_TEXT) {
+        return err;
+    }
 
+    nlohmann::json control = nlohmann::json::parse(buf, buf + message.len, nullptr, false);
+    if (!control.is_object()) {
+        ESP_LOGW(TAG, "Ignoring malformed /ws control message");
+        return ESP_OK;
+    }
+    std::lock_guard<std::mutex> lock(ws_mutex);
+    ws_stats.controls++;
+    for (WsClient& c : ws_clients) {
+        if (c.fd != fd) {
+            continue;
+        }
+        if (control.contains("fps") && control["fps"].is_number()) {
+            c.fps = std::min(std::max(control["fps"].get<int>(), 1), 30);
+            c.next_us = 0;
+        }
+        if (control.contains("jpeg") && control["jpeg"].is_boolean()) {
+            c.jpeg = control["jpeg"].get<bool>();
+        }
+    }
     return ESP_OK;
 }
+#endif
 
 esp_err_t gesture_name_handler(httpd_req_t *req) {
+    TRACE_FUNCTION();
+    std::shared_ptr<const InferenceFrame> frame = latest_frame();
+    const char* gesture = frame ? gesture_name(frame->prediction.class_index) : "none";
+    httpd_resp_set_type(req, "text/plain");
+    httpd_resp_sendstr(req, gesture);
+    return ESP_OK;
+}
+
+esp_err_t prediction_handler(httpd_req_t *req) {
+    TRACE_FUNCTION();
+    std::shared_ptr<const InferenceFrame> frame = latest_frame();
+    if (!frame) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No prediction yet");
+        return ESP_FAIL;
+    }
+
+    const Prediction& p = frame->prediction;
+    nlohmann::json result = {
+        {"frame_id", p.frame_id},
+        {"class", p.class_index},
+        {"gesture", gesture_name(p.class_index)},
+        {"confidence", p.confidence},
+        {"reused", p.reused},
+        {"scores", std::vector<float>(p.scores, p.scores + p.num_scores)},
+        {"capture_us", p.capture_us},
+        {"preprocess_us", p.preprocess_us},
+        {"inference_us", p.inference_us},
+        {"encode_us", p.encode_us},
+        {"published_us", p.published_us},
+        {"age_us", esp_timer_get_time() - p.capture_us},
+    };
+
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_sendstr(req, result.dump().c_str());
+}
+
+
+/// Bytes read from the socket at a time by /predict.
+static constexpr size_t kUploadChunkSize = 2048;
+
+/**
+ * @brief Image formats accepted by /predict.
+ */
+enum class UploadFormat { Raw, Pgm, Jpeg };
+
+static const char* upload_format_name(UploadFormat format) {
+    switch (format) {
+        case UploadFormat::Raw: return "raw";
+        case UploadFormat::Pgm: return "pgm";
+        case UploadFormat::Jpeg: return "jpeg";
+    }
+    return "";
+}
+
+/**
+ * @brief Receives up to len bytes of the request body, retrying on socket timeouts.
+ *
+ * @return The bytes received, or a negative HTTPD_SOCK_ERR_* code.
+ */
+static int recv_body(httpd_req_t *req, uint8_t* buf, size_t len) {
+    int ret;
+    do {
+        ret = httpd_req_recv(req, (char*)buf, len);
+    } while (ret == HTTPD_SOCK_ERR_TIMEOUT);
+    return ret;
+}
+
+/**
+ * @brief Receives until buf is full or the body ends.
+ *
+ * @return The bytes received, or a negative HTTPD_SOCK_ERR_* code.
+ */
+static int recv_full(httpd_req_t *req, uint8_t* buf, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        int ret = recv_body(req, buf + got, len - got);
+        if (ret < 0) {
+            return ret;
+        }
+        if (ret == 0) {
+            break;
+        }
+        got += ret;
+    }
+    return got;
+}
+
+/**
+ * @brief Parses the header of a binary PGM (P5) image.
+ *
+ * @param data The start of the image.
+ * @param len The bytes available.
+ * @param[out] width The image width.
+ * @param[out] height The image height.
+ * @param[out] maxval The largest pixel value.
+ * @return The size of the header, or 0 if it is invalid or not within len bytes.
+ */
+static size_t parse_pgm_header(const uint8_t* data, size_t len, int& width, int& height, int& maxval) {
+    if (len < 2 || data[0] != 'P' || data[1] != '5') {
+        return 0;
+    }
+    size_t pos = 2;
+    int* fields[] = {&width, &height, &maxval};
+    for (int* field : fields) {
+        // Whitespace and comments up to the end of their line separate the fields
+        while (pos < len && (isspace(data[pos]) || data[pos] == '#')) {
+            if (data[pos] == '#') {
+                while (pos < len && data[pos] != '\n') {
+                    pos++;
+                }
+            } else {
+                pos++;
+            }
+        }
+        if (pos == len || !isdigit(data[pos])) {
+            return 0;
+        }
+        *field = 0;
+        while (pos < len && isdigit(data[pos]) && *field < 65536) {
+            *field = *field * 10 + (data[pos++] - '0');
+        }
+    }
+    // A single whitespace character separates the header from the pixels
+    if (pos == len || !isspace(data[pos])) {
+        return 0;
+    }
+    return pos + 1;
+}
+
+esp_err_t predict_handler(httpd_req_t *req) {
+    TRACE_FUNCTION();
     TFLiteModel* model = static_cast<TFLiteModel*>(req->user_ctx);
     if (!model || !model->is_initialized()) {
+        ESP_LOGE(TAG, "Model not initialized or not passed in context");
         httpd_resp_send_500(req);
         return ESP_FAIL;
     }
 
-    const char* gesture = GESTURES[model->last_detected_index()];
-    httpd_resp_set_type(req, "text/plain");
-    httpd_resp_sendstr(req, gesture);
-    return ESP_OK;
+    const int64_t start_us = esp_timer_get_time();
+    if (req->content_len == 0) {
+        httpd_resp_send_err(req, HTTPD_411_LENGTH_REQUIRED, "Send an image in the body");
+        return ESP_FAIL;
+    }
+
+    int width = 0, height = 0;
+    char query[64] = "";
+    char value[8];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        if (httpd_query_key_value(query, "width", value, sizeof(value)) == ESP_OK) {
+            width = atoi(value);
+        }
+        if (httpd_query_key_value(query, "height", value, sizeof(value)) == ESP_OK) {
+            height = atoi(value);
+        }
+    }
+
+    // The first chunk holds the JPEG signature or the PGM header
+    std::unique_ptr<uint8_t[]> chunk(new (std::nothrow) uint8_t[kUploadChunkSize]);
+    if (!chunk) {
+        httpd_resp_send_500(req);
+        return ESP_ERR_NO_MEM;
+    }
+    int len = recv_full(req, chunk.get(), std::min(req->content_len, kUploadChunkSize));
+    if (len <= 0) {
+        httpd_resp_send_err(req, HTTPD_408_REQ_TIMEOUT, "Upload failed");
+        return ESP_FAIL;
+    }
+    size_t received = len;
+
+    UploadFormat format;
+    size_t offset = 0; // start of the pixels in the first chunk
+    int maxval = 255;
+    if (width > 0 && height > 0) {
+        format = UploadFormat::Raw;
+    } else if (len >= 2 && chunk[0] == 0xFF && chunk[1] == 0xD8) {
+        format = UploadFormat::Jpeg;
+    } else if ((offset = parse_pgm_header(chunk.get(), len, width, height, maxval)) > 0) {
+        format = UploadFormat::Pgm;
+    } else {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                            "Expected a JPEG, a binary PGM or raw grayscale with ?width=&height=");
+        return ESP_FAIL;
+    }
+
+    Prediction prediction;
+    prediction.capture_us = start_us;
+    size_t buffer_bytes = kUploadChunkSize;
+    int64_t decode_us = 0;
+    int64_t receive_end_us;
+    esp_err_t err;
+
+    if (format == UploadFormat::Jpeg) {
+        // The decoder reads the whole JPEG from memory, only the compressed bytes are kept
+        if (req->content_len > CONFIG_PREDICT_MAX_JPEG_SIZE * 1024) {
+            httpd_resp_send_err(req, HTTPD_413_CONTENT_TOO_LARGE, "JPEG too large");
+            return ESP_FAIL;
+        }
+        std::unique_ptr<uint8_t, HeapCapsDeleter> jpeg((uint8_t*)heap_caps_malloc(req->content_len, MALLOC_CAP_SPIRAM));
+        if (!jpeg) {
+            httpd_resp_send_500(req);
+            return ESP_ERR_NO_MEM;
+        }
+        memcpy(jpeg.get(), chunk.get(), len);
+        chunk.reset();
+        len = recv_full(req, jpeg.get() + received, req->content_len - received);
+        if (len < 0 || received + len != req->content_len) {
+            httpd_resp_send_err(req, HTTPD_408_REQ_TIMEOUT, "Upload failed");
+            return ESP_FAIL;
+        }
+        received = req->content_len;
+        receive_end_us = esp_timer_get_time();
+
+        camera_fb_t fb = {};
+        fb.buf = jpeg.get();
+        fb.len = received;
+        fb.format = PIXFORMAT_JPEG;
+        if (read_jpeg_size(fb.buf, fb.len, fb.width, fb.height) != ESP_OK) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid JPEG");
+            return ESP_FAIL;
+        }
+        width = fb.width;
+        height = fb.height;
+
+        // Decode at the strongest reduction that still covers the model input
+        const ImageGeometry& input = model->input_geometry();
+        int scale = 8;
+        size_t w, h;
+        for (decoded_jpeg_size(&fb, scale, w, h); scale > 1 && ((int)w < input.width || (int)h < input.height);
+             decoded_jpeg_size(&fb, scale, w, h)) {
+            scale /= 2;
+        }
+        if (w > CONFIG_PREDICT_MAX_DIMENSION || h > CONFIG_PREDICT_MAX_DIMENSION) {
+            httpd_resp_send_err(req, HTTPD_413_CONTENT_TOO_LARGE, "Image too large");
+            return ESP_FAIL;
+        }
+        const size_t size = w * h * 3;
+        std::unique_ptr<uint8_t, HeapCapsDeleter> pixels((uint8_t*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM));
+        err = pixels ? decode_jpeg_to_grayscale(&fb, scale, pixels.get(), size) : ESP_ERR_NO_MEM;
+        decode_us = esp_timer_get_time() - receive_end_us;
+        buffer_bytes = received + size;
+        if (err == ESP_OK) {
+            err = predict_frame(model, pixels.get(), w, h, prediction);
+        }
+    } else {
+        if (width > CONFIG_PREDICT_MAX_DIMENSION || height > CONFIG_PREDICT_MAX_DIMENSION || maxval == 0 ||
+            maxval > 255) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unsupported image size or depth");
+            return ESP_FAIL;
+        }
+        if (req->content_len < offset + (size_t)width * height) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Body shorter than the image");
+            return ESP_FAIL;
+        }
+        auto plan = preprocess_resize_plan(width, height, model->input());
+        if (!plan) {
+            httpd_resp_send_500(req);
+            return ESP_FAIL;
+        }
+
+        // Rows are resized to the model input as they arrive, so the image is never held whole
+        std::unique_ptr<uint8_t[]> resized(new (std::nothrow) uint8_t[plan->dst_w() * plan->dst_h()]);
+        if (!resized) {
+            httpd_resp_send_500(req);
+            return ESP_ERR_NO_MEM;
+        }
+        ResizeStream stream(plan, resized.get());
+        buffer_bytes += plan->dst_w() * plan->dst_h() + stream.window_size();
+        while (true) {
+            uint8_t* data = chunk.get() + offset;
+            const size_t n = len - offset;
+            if (maxval != 255) {
+                for (size_t i = 0; i < n; i++) {
+                    data[i] = std::min(data[i], (uint8_t)maxval) * 255 / maxval;
+                }
+            }
+            const int64_t push_start_us = esp_timer_get_time();
+            stream.push(data, n);
+            decode_us += esp_timer_get_time() - push_start_us;
+            offset = 0;
+
+            if (received == req->content_len) {
+                break;
+            }
+            len = recv_body(req, chunk.get(), std::min(req->content_len - received, kUploadChunkSize));
+            if (len <= 0) {
+                httpd_resp_send_err(req, HTTPD_408_REQ_TIMEOUT, "Upload failed");
+                return ESP_FAIL;
+            }
+            received += len;
+        }
+        receive_end_us = esp_timer_get_time();
+        err = predict_frame(model, resized.get(), plan->dst_w(), plan->dst_h(), prediction);
+    }
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Prediction on upload failed: %s", esp_err_to_name(err));
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    nlohmann::json result = {
+        {"format", upload_format_name(format)},
+        {"width", width},
+        {"height", height},
+        {"bytes", received},
+        {"buffer_bytes", buffer_bytes},
+        {"class", prediction.class_index},
+        {"gesture", gesture_name(prediction.class_index)},
+        {"confidence", prediction.confidence},
+        {"scores", std::vector<float>(prediction.scores, prediction.scores + prediction.num_scores)},
+        {"receive_us", receive_end_us - start_us},
+        {"decode_us", decode_us},
+        {"preprocess_us", prediction.preprocess_us},
+        {"inference_us", prediction.inference_us},
+        {"total_us", esp_timer_get_time() - start_us},
+    };
+
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_sendstr(req, result.dump().c_str());
+}
+
+
+/**
+ * @brief Converts profiler statistics to JSON with timings in microseconds.
+ */
+static nlohmann::json op_stats_json(const OpProfiler::OpStats& s) {
+    return {
+        {"op", s.tag},
+        {"count", s.count},
+        {"min_us", OpProfiler::cycles_to_us(s.min_cycles)},
+        {"mean_us", OpProfiler::cycles_to_us(s.mean_cycles)},
+        {"p99_us", OpProfiler::cycles_to_us(s.p99_cycles)},
+        {"max_us", OpProfiler::cycles_to_us(s.max_cycles)},
+    };
+}
+
+esp_err_t profile_handler(httpd_req_t *req) {
+    TRACE_FUNCTION();
+    TFLiteModel* model = static_cast<TFLiteModel*>(req->user_ctx);
+    if (!model || !model->is_initialized()) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    OpProfiler* profiler = model->profiler();
+    if (!profiler) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Profiler disabled (CONFIG_MODEL_PROFILER)");
+        return ESP_FAIL;
+    }
+
+    nlohmann::json ops = nlohmann::json::array();
+    for (const OpProfiler::OpStats& s : profiler->ops()) {
+        ops.push_back(op_stats_json(s));
+    }
+    nlohmann::json report = {
+        {"invocations", profiler->invocations()},
+        {"ops", ops},
+        {"invoke", op_stats_json(profiler->total())},
+    };
+
+    profiler->log_report();
+
+    char query[32];
+    char value[8];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "reset", value, sizeof(value)) == ESP_OK) {
+        profiler->reset();
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_sendstr(req, report.dump().c_str());
+}
+
+
+esp_err_t pipeline_handler(httpd_req_t *req) {
+    TRACE_FUNCTION();
+    nlohmann::json stages = nlohmann::json::array();
+    for (int i = 0; InferencePipeline::is_running() && i < InferencePipeline::kNumStages; i++) {
+        StageStats s = InferencePipeline::stats(static_cast<InferencePipeline::Stage>(i));
+        stages.push_back({
+            {"stage", s.name},
+            {"processed", s.processed},
+            {"failed", s.failed},
+            {"dropped", s.dropped},
+            {"queue_depth", s.queue_depth},
+            {"max_queue_depth", s.max_queue_depth},
+            {"mean_service_us", s.mean_service_us},
+            {"max_service_us", s.max_service_us},
+        });
+    }
+    nlohmann::json report = {
+        {"frames_published", frames_published()},
+        {"stages", stages},
+    };
+    if (InferencePipeline::is_running()) {
+        FramePoolStats p = InferencePipeline::pool_stats();
+        report["frame_pool"] = {
+            {"frames", p.frames},
+            {"pixel_bytes", p.pixel_bytes},
+            {"free", p.free},
+            {"waits", p.waits},
+        };
+    }
+
+    FrameSource& source = FrameSource::getInstance();
+    FrameSource::Stats f = source.stats();
+    report["frame_source"] = {
+        {"source", source.name()},
+        {"fresh_requests", f.fresh_requests},
+        {"stale_flushes", f.stale_flushes},
+        {"mean_wait_us", f.mean_wait_us},
+        {"max_wait_us", f.max_wait_us},
+        {"flush_wait_us", f.flush_wait_us},
+    };
+
+    MotionGate* gate = motion_gate();
+    if (gate) {
+        MotionGate::Stats g = gate->stats();
+        report["motion_gate"] = {
+            {"executed", g.executed},
+            {"skipped", g.skipped},
+            {"last_difference", g.last_difference},
+        };
+    }
+
+    JpegPool& pool = JpegPool::getInstance();
+    JpegPool::Stats j = pool.stats();
+    report["jpeg_pool"] = {
+        {"buffers", j.buffers},
+        {"buffer_size", j.buffer_size},
+        {"in_use", j.in_use},
+        {"peak_in_use", j.peak_in_use},
+        {"acquired", j.acquired},
+        {"exhausted", j.exhausted},
+        {"overflows", j.overflows},
+        {"fallback_allocations", j.fallback_allocations},
+        {"psram_free", j.psram_free},
+        {"psram_largest_block", j.psram_largest_block},
+        // 0 while the free PSRAM is one block, towards 1 as it splits up
+        {"psram_fragmentation", j.psram_free ? 1.0f - (float)j.psram_largest_block / j.psram_free : 0.0f},
+    };
+
+    static const char* const kCaptureModes[] = {"cached", "buffered", "streamed"};
+    {
+        std::lock_guard<std::mutex> lock(capture_stats_mutex);
+        for (int i = 0; i < static_cast<int>(CaptureMode::kCount); i++) {
+            const CaptureStats& c = capture_stats[i];
+            report["capture"][kCaptureModes[i]] = {
+                {"responses", c.responses},
+                {"mean_ttfb_us", c.responses ? c.total_ttfb_us / c.responses : 0},
+                {"max_ttfb_us", c.max_ttfb_us},
+                {"mean_response_us", c.responses ? c.total_us / c.responses : 0},
+                {"max_response_us", c.max_us},
+                {"max_buffer_bytes", c.max_buffer_bytes},
+            };
+        }
+    }
+
+    CoalesceStats k = capture_shared_stats();
+    report["capture_coalescing"] = {
+        {"requests", k.requests},
+        {"flights", k.flights},
+        {"joined", k.joined},
+        {"failed", k.failed},
+        {"max_waiters", k.max_waiters},
+        // Requests served per executed capture, 1 without sharing
+        {"ratio", k.flights ? (float)k.requests / k.flights : 0.0f},
+    };
+
+    HttpWorkers::Stats w = HttpWorkers::stats();
+    report["http_workers"] = {
+        {"submitted", w.submitted},
+        {"rejected", w.rejected},
+        {"completed", w.completed},
+        {"queue_depth", w.queue_depth},
+        {"max_queue_depth", w.max_queue_depth},
+        {"busy_workers", w.busy_workers},
+        {"mean_wait_us", w.mean_wait_us},
+        {"max_wait_us", w.max_wait_us},
+        {"mean_service_us", w.mean_service_us},
+        {"max_service_us", w.max_service_us},
+    };
+
+    {
+        std::lock_guard<std::mutex> lock(sse_mutex);
+        report["events"] = {
+            {"clients", sse_stats.clients},
+            {"connections", sse_stats.connections},
+            {"rejected", sse_stats.rejected},
+            {"records", sse_stats.records},
+            {"delivered", sse_stats.delivered},
+            {"skipped", sse_stats.skipped},
+            {"backpressure", sse_stats.backpressure},
+            {"stalled", sse_stats.stalled},
+        };
+    }
+
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    {
+        std::lock_guard<std::mutex> lock(ws_mutex);
+        report["websocket"] = {
+            {"clients", ws_stats.clients},
+            {"connections", ws_stats.connections},
+            {"rejected", ws_stats.rejected},
+            {"messages", ws_stats.messages},
+            {"failed", ws_stats.failed},
+            {"busy_skips", ws_stats.busy_skips},
+            {"controls", ws_stats.controls},
+            {"bytes", ws_stats.bytes},
+        };
+    }
+#endif
+
+    {
+        std::lock_guard<std::mutex> lock(stream_stats_mutex);
+        const StreamStats& m = stream_stats;
+        report["stream"] = {
+            {"clients", m.clients},
+            {"sessions", m.sessions},
+            {"rejected", m.rejected},
+            {"parts", m.parts},
+            {"skipped_slots", m.skipped_slots},
+            {"unsent_frames", m.unsent_frames},
+            {"bytes", m.bytes},
+            {"mean_send_us", m.parts ? m.total_send_us / m.parts : 0},
+            {"max_send_us", m.max_send_us},
+        };
+    }
+
+    char query[32];
+    char value[8];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "reset", value, sizeof(value)) == ESP_OK) {
+        InferencePipeline::reset_stats();
+        source.reset_stats();
+        pool.reset_stats();
+        HttpWorkers::reset_stats();
+        reset_capture_shared_stats();
+        {
+            std::lock_guard<std::mutex> lock(capture_stats_mutex);
+            std::fill(std::begin(capture_stats), std::end(capture_stats), CaptureStats());
+        }
+        {
+            std::lock_guard<std::mutex> lock(sse_mutex);
+            SseStats cleared;
+            cleared.clients = sse_stats.clients;
+            sse_stats = cleared;
+        }
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+        {
+            std::lock_guard<std::mutex> lock(ws_mutex);
+            WsStats cleared;
+            cleared.clients = ws_stats.clients;
+            ws_stats = cleared;
+        }
+#endif
+        {
+            std::lock_guard<std::mutex> lock(stream_stats_mutex);
+            StreamStats cleared;
+            cleared.clients = stream_stats.clients;
+            stream_stats = cleared;
+        }
+        if (gate) {
+            gate->reset_stats();
+        }
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_sendstr(req, report.dump().c_str());
+}
+
+
+esp_err_t trace_handler(httpd_req_t *req) {
+    TRACE_FUNCTION();
+    LatencyTraceRing* traces = latency_traces();
+    if (!traces) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Latency tracing disabled (CONFIG_LATENCY_TRACE)");
+        return ESP_FAIL;
+    }
+
+    size_t count = 16;
+    char query[32];
+    char value[8];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "n", value, sizeof(value)) == ESP_OK) {
+        count = strtoul(value, nullptr, 10);
+    }
+
+    // Points relative to the sensor timestamp, absent points are left out
+    nlohmann::json records = nlohmann::json::array();
+    for (const FrameTrace& trace : traces->last(count)) {
+        const int64_t origin = trace.get(TracePoint::Capture);
+        nlohmann::json points = nlohmann::json::object();
+        for (int i = 0; i < FrameTrace::kPoints; i++) {
+            if (trace.at[i]) {
+                points[trace_point_name(static_cast<TracePoint>(i))] = trace.at[i] - origin;
+            }
+        }
+        records.push_back({{"frame_id", trace.frame_id}, {"capture_us", origin}, {"points_us", points}});
+    }
+
+    nlohmann::json summary = nlohmann::json::array();
+    for (const LatencyTraceRing::Summary& s : traces->summarize()) {
+        summary.push_back({
+            {"segment", s.name},
+            {"count", s.count},
+            {"p50_us", s.p50_us},
+            {"p90_us", s.p90_us},
+            {"p99_us", s.p99_us},
+            {"max_us", s.max_us},
+        });
+    }
+
+    nlohmann::json report = {
+        {"recorded", traces->pushed()},
+        {"capacity", traces->capacity()},
+        {"records", records},
+        {"summary", summary},
+    };
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_sendstr(req, report.dump().c_str());
+}
+
+
+#ifdef CONFIG_EVENT_TRACE
+esp_err_t events_handler(httpd_req_t *req) {
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"events.json\"");
+
+    ChunkWriter out(req);
+    out.printf("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    // One process per core, one thread per task
+    struct Thread {
+        uint32_t task_id;
+        uint8_t core;
+        char name[EventTrace::kTaskNameLen];
+    };
+    std::vector<Thread> threads;
+
+    const uint32_t head = EventTrace::head();
+    const uint32_t count = std::min<uint32_t>(head, EventTrace::capacity());
+    EventTrace::Event e;
+    for (uint32_t index = head - count; index != head; index++) {
+        if (!EventTrace::read(index, e)) {
+            continue; // Overwritten while streaming
+        }
+        out.printf("{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lu,\"pid\":%u,\"tid\":%lu},",
+                   e.name, (long long)e.start_us, (unsigned long)e.duration_us, e.core, (unsigned long)e.task_id);
+
+        bool known = std::any_of(threads.begin(), threads.end(), [&](const Thread& t) {
+            return t.task_id == e.task_id && t.core == e.core;
+        });
+        if (!known) {
+            Thread thread = {e.task_id, e.core, {}};
+            memcpy(thread.name, e.task_name, sizeof(thread.name));
+            threads.push_back(thread);
+        }
+    }
+
+    for (int core = 0; core < 2; core++) {
+        out.printf("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"core %d\"}},",
+                   core, core);
+    }
+    for (const Thread& t : threads) {
+        out.printf("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%lu,\"args\":{\"name\":\"%s\"}},",
+                   t.core, (unsigned long)t.task_id, t.name);
+    }
+    // Ends with an element without a trailing comma
+    out.printf("{\"name\":\"trace\",\"ph\":\"M\",\"pid\":0,\"args\":{\"events\":%lu}}]}",
+               (unsigned long)count);
+    return out.finish();
 }
+#endif
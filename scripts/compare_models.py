@@ -0,0 +1,122 @@
+"""Script to compare TensorFlow Lite exports of the gesture model.
+
+Runs every model on the validation split used in `train.py` and reports
+top-1 accuracy, agreement with the first model, mean host inference
+latency, flatbuffer size, number of Transpose ops and the size of all
+non-constant tensors (an upper bound of the tensor arena). Inputs are
+normalized to [-1, 1] as in training and in the firmware's
+`normalize_pixel()`. Int8 inputs are quantized and int8 outputs dequantized
+with the tensors' own scale and zero-point, and NHWC models get NHWC
+inputs, as the firmware does.
+By default it compares the float and int8 models.
+"""
+import argparse
+import collections
+import os
+import time
+
+import numpy
+import tensorflow as tf
+import torch
+from torchvision import datasets, transforms
+
+import train
+
+DATA_ROOT = "../data/HG14/HG14-Hand-Gesture/"
+IMG_SIZE = 32
+
+
+class TFLiteRunner:
+    """Runs single images through a .tflite model, handling (de)quantization.
+
+    Args:
+        path (str): Path to the .tflite file.
+    """
+    def __init__(self, path):
+        self.path = path
+        self.interpreter = tf.lite.Interpreter(model_path=path)
+        self.interpreter.allocate_tensors()
+        self.input = self.interpreter.get_input_details()[0]
+        self.output = self.interpreter.get_output_details()[0]
+        self.latencies = []
+        shape = self.input["shape"]
+        self.channels_last = len(shape) == 4 and shape[3] == 1 and shape[1] != 1
+
+        ops = self.interpreter._get_ops_details()
+        self.ops = collections.Counter(op["op_name"] for op in ops)
+        # Activations are the graph input plus every op output; everything else is a constant
+        activations = {self.input["index"]} | {i for op in ops for i in op["outputs"]}
+        self.activation_bytes = sum(
+            int(numpy.prod(t["shape"])) * numpy.dtype(t["dtype"]).itemsize
+            for t in self.interpreter.get_tensor_details() if t["index"] in activations)
+
+    def __call__(self, image):
+        """Returns float scores for one 1x1x32x32 float32 image."""
+        if self.channels_last:
+            image = image.transpose(0, 2, 3, 1)
+        x = image
+        if self.input["dtype"] != numpy.float32:
+            scale, zero_point = self.input["quantization"]
+            info = numpy.iinfo(self.input["dtype"])
+            x = numpy.clip(numpy.round(image / scale) + zero_point, info.min, info.max)
+        self.interpreter.set_tensor(self.input["index"], x.astype(self.input["dtype"]))
+
+        start = time.perf_counter()
+        self.interpreter.invoke()
+        self.latencies.append(time.perf_counter() - start)
+
+        y = self.interpreter.get_tensor(self.output["index"])[0]
+        if self.output["dtype"] != numpy.float32:
+            scale, zero_point = self.output["quantization"]
+            y = (y.astype(numpy.float32) - zero_point) * scale
+        return y
+
+
+def validation_set():
+    """Returns the validation split of the HG14 dataset used by `train.py`."""
+    transform = transforms.Compose([
+        transforms.Grayscale(num_output_channels=1),
+        transforms.Resize((IMG_SIZE, IMG_SIZE)),
+        transforms.ToTensor(),
+        transforms.Normalize((0.5,), (0.5,))
+    ])
+    dataset = datasets.ImageFolder(root=os.path.join(DATA_ROOT), transform=transform)
+    return torch.utils.data.Subset(dataset, train.validation_indices(len(dataset)))
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("models", nargs="*",
+                        default=["../models/model_nof16.tflite", "../models/model_int8.tflite"],
+                        help="models to compare; agreement is reported against the first one")
+    parser.add_argument("--limit", type=int, default=0, help="evaluate at most this many images")
+    args = parser.parse_args()
+
+    runners = [TFLiteRunner(path) for path in args.models]
+    correct = [0] * len(runners)
+    agree = [0] * len(runners)
+    total = 0
+
+    for image, label in validation_set():
+        if args.limit and total >= args.limit:
+            break
+        x = image.unsqueeze(0).numpy().astype(numpy.float32)
+        predictions = [int(numpy.argmax(runner(x))) for runner in runners]
+        for i, prediction in enumerate(predictions):
+            correct[i] += prediction == label
+            agree[i] += prediction == predictions[0]
+        total += 1
+
+    print(f"Evaluated {total} validation images\n")
+    print(f"{'model':<28} {'size [KB]':>10} {'transposes':>10} {'activ. [KB]':>11} "
+          f"{'accuracy':>9} {'agreement':>10} {'latency [us]':>13}")
+    for runner, hits, same in zip(runners, correct, agree):
+        print(f"{os.path.basename(runner.path):<28} "
+              f"{os.path.getsize(runner.path) / 1024:>10.1f} "
+              f"{runner.ops['TRANSPOSE']:>10} "
+              f"{runner.activation_bytes / 1024:>11.1f} "
+              f"{hits / total:>9.2%} "
+              f"{same / total:>10.2%} "
+              f"{numpy.mean(runner.latencies) * 1e6:>13.1f}")
+    print("\nHost latency only shows relative cost; the firmware logs the on-device arena usage "
+          "and /profile the on-device latency.")
@@ -4,36 +4,200 @@ This script loads a pre-trained PyTorch CNN model, converts it into a
 TensorFlow Lite model, and then exports it to a `.tflite` file. It also
 includes a verification step to compare the inference results of the
 original PyTorch model and the converted TensorFlow Lite model.
+
+With `--int8` the model is fully post-training quantized: weights,
+activations, input and output are int8, calibrated on a representative
+subset of the training images. This lets esp-nn's optimized int8 kernels
+run on the ESP32 instead of the reference float kernels.
+
+With `--nhwc` the graph takes a 1x32x32x1 (NHWC) input and flattens the
+features in HWC order, so no layout Transpose ops are left in it.
+
+With `--cc` the resulting flatbuffer is also written as the C array
+embedded in the firmware (`models/model.cc`).
 """
+import argparse
+import collections
+import os
+
 import torch
+import torch.nn.functional as F
 import ai_edge_torch
 import tensorflow as tf
 import numpy
+from torch.utils.data import DataLoader
+from torchvision import datasets, transforms
 import cnn
+import train
+
+DATA_ROOT = "../data/HG14/HG14-Hand-Gesture/"
+IMG_SIZE = 32
+
+
+def representative_dataset(num_samples=200, channels_last=False):
+    """Yields calibration samples for post-training quantization.
+
+    Images are preprocessed the same way as in `train.py`, so the
+    calibrated activation ranges match what the model saw during training.
+
+    Args:
+        num_samples (int): Number of images used for calibration.
+        channels_last (bool): Yield NHWC instead of NCHW inputs.
+
+    Yields:
+        list[numpy.ndarray]: A single-element list with a 1x1x32x32 (or 1x32x32x1) float32 input.
+    """
+    transform = transforms.Compose([
+        transforms.Grayscale(num_output_channels=1),
+        transforms.Resize((IMG_SIZE, IMG_SIZE)),
+        transforms.ToTensor(),
+        transforms.Normalize((0.5,), (0.5,))
+    ])
+    dataset = datasets.ImageFolder(root=os.path.join(DATA_ROOT), transform=transform)
+    # Only training images, so calibration does not see the images compare_models.py scores
+    validation = set(train.validation_indices(len(dataset)))
+    training = torch.utils.data.Subset(dataset, [i for i in range(len(dataset)) if i not in validation])
+    generator = torch.Generator().manual_seed(0)
+    loader = DataLoader(training, batch_size=1, shuffle=True, generator=generator)
+
+    for i, (inputs, _) in enumerate(loader):
+        if i >= num_samples:
+            break
+        if channels_last:
+            inputs = inputs.permute(0, 2, 3, 1)
+        yield [inputs.numpy().astype(numpy.float32)]
+
+
+class ChannelsLastCNN(torch.nn.Module):
+    """Wraps a trained cnn.CNN so that it exports as an NHWC-native graph.
+
+    The input is NHWC and the feature map is flattened in HWC order, with the
+    fully connected weights permuted to match. Every layout permute then
+    cancels out against the ones the converter inserts around convolutions,
+    so the exported graph contains no Transpose ops.
+
+    Args:
+        model (cnn.CNN): The trained model.
+    """
+    def __init__(self, model):
+        super().__init__()
+        self.model = model
+        fc = model.fc1
+        # [classes, C*H*W] -> [classes, H*W*C]
+        self.fc_weight = torch.nn.Parameter(
+            fc.weight.detach().view(fc.out_features, 16, 6, 6).permute(0, 2, 3, 1)
+            .reshape(fc.out_features, -1).clone())
+
+    def forward(self, x):
+        """Runs the model on an NHWC batch and returns the logits."""
+        m = self.model
+        x = x.permute(0, 3, 1, 2)
+        x = m.pool1(m.relu1(m.bn1(m.conv1(x))))
+        x = m.pool2(m.relu2(m.bn2(m.conv2(x))))
+        x = x.permute(0, 2, 3, 1).flatten(1)
+        return F.linear(x, self.fc_weight, m.fc1.bias)
+
+
+def count_ops(tflite_path):
+    """Returns a histogram of the operators in a .tflite file.
+
+    Args:
+        tflite_path (str): Path of the .tflite file.
+
+    Returns:
+        collections.Counter: Operator name -> number of occurrences.
+    """
+    interpreter = tf.lite.Interpreter(model_path=tflite_path)
+    return collections.Counter(op["op_name"] for op in interpreter._get_ops_details())
+
+
+def write_c_array(tflite_path, cc_path):
+    """Writes a .tflite flatbuffer as the C array used by the firmware.
+
+    Args:
+        tflite_path (str): Path of the .tflite file to embed.
+        cc_path (str): Path of the generated source file.
+    """
+    with open(tflite_path, "rb") as f:
+        data = f.read()
+
+    lines = []
+    for i in range(0, len(data), 12):
+        lines.append("  " + ", ".join(f"0x{b:02x}" for b in data[i:i + 12]))
+
+    with open(cc_path, "w") as f:
+        f.write('#include "model.h"\n\n')
+        f.write("alignas(8) const unsigned char model_tflite[] = {\n")
+        f.write(",\n".join(lines))
+        f.write("\n};\n")
+        f.write(f"const unsigned int model_tflite_len = {len(data)};\n")
+
 
 if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--int8", action="store_true",
+                        help="full int8 post-training quantization with calibration")
+    parser.add_argument("--nhwc", action="store_true",
+                        help="export an NHWC-native graph without Transpose ops")
+    parser.add_argument("--cc", action="store_true",
+                        help="also write the firmware C array to ../models/model.cc")
+    args = parser.parse_args()
+
     model = cnn.CNN()
     model.load_state_dict(torch.load("../models/cnn_trained_input32.pt"))
+    model.eval()
 
-    dummy_input = (torch.randn(1, 1, 32, 32),)  # 1 batch, 1x32x32
+    reference_input = torch.randn(1, 1, 32, 32)  # 1 batch, 1x32x32
+    export_model = model
+    dummy_input = (reference_input,)
+    suffix = ""
+    if args.nhwc:
+        export_model = ChannelsLastCNN(model).eval()
+        dummy_input = (reference_input.permute(0, 2, 3, 1),)
+        suffix = "_nhwc"
 
-    tfl_converter_flags = {'optimizations': [tf.lite.Optimize.DEFAULT]}
+    if args.int8:
+        tfl_converter_flags = {
+            'optimizations': [tf.lite.Optimize.DEFAULT],
+            'representative_dataset': lambda: representative_dataset(channels_last=args.nhwc),
+            'target_spec': {'supported_ops': [tf.lite.OpsSet.TFLITE_BUILTINS_INT8]},
+            'inference_input_type': tf.int8,
+            'inference_output_type': tf.int8,
+        }
+        output_path = f"../models/model_int8{suffix}.tflite"
+        edge_model = ai_edge_torch.convert(export_model, dummy_input,
+                                           _ai_edge_converter_flags=tfl_converter_flags)
+    else:
+        output_path = f"../models/model_nof16{suffix}.tflite"
+        edge_model = ai_edge_torch.convert(export_model, dummy_input)
+
+    edge_model.export(output_path)
 
-    edge_model = ai_edge_torch.convert(model.eval(), dummy_input) # _ai_edge_converter_flags=tfl_converter_flags
-    edge_model.export("../models/model_nof16.tflite")
+    print(f"Model converted to TFLite format and saved to {output_path}")
 
-    print("Model converted to TFLite format and saved to ../models/model_nof16.tflite")
+    ops = count_ops(output_path)
+    print("Operators: " + ", ".join(f"{name} x{n}" for name, n in sorted(ops.items())))
+    if args.nhwc and ops["TRANSPOSE"]:
+        print(f"Warning: {ops['TRANSPOSE']} TRANSPOSE ops left in the NHWC graph")
 
-    # Check the model
-    torch_output = model(*dummy_input)
-    edge_output = edge_model(*dummy_input)
+    if args.cc:
+        write_c_array(output_path, "../models/model.cc")
+        print("Firmware model written to ../models/model.cc")
 
-    if (numpy.allclose(
-        torch_output.detach().numpy(),
-        edge_output,
-        atol=1e-5,
-        rtol=1e-5,
-    )):
-        print("Inference result with Pytorch and TfLite was within tolerance")
+    if args.int8:
+        # The quantized graph has int8 I/O, so its accuracy is checked by compare_models.py
+        print("Run compare_models.py to compare the int8 model against the float one")
     else:
-        print("Something wrong with Pytorch --> TfLite")
\ No newline at end of file
+        # Check the model
+        torch_output = model(reference_input)
+        edge_output = edge_model(*dummy_input)
+
+        if (numpy.allclose(
+            torch_output.detach().numpy(),
+            edge_output,
+            atol=1e-5,
+            rtol=1e-5,
+        )):
+            print("Inference result with Pytorch and TfLite was within tolerance")
+        else:
+            print("Something wrong with Pytorch --> TfLite")
@@ -0,0 +1,123 @@
+"""Script to embed grayscale frames in the firmware for the replay frame source.
+
+Reads every `.pgm` (binary P5 or ASCII P2, 8-bit) and `.raw` file of a
+directory in name order and writes them as the `replay_frames` table
+declared in `include/frame_source.h`. Raw files hold bare 8-bit pixels; their
+size is taken from a `_<width>x<height>` suffix in the file name (e.g.
+`fist_96x96.raw`) or from `--raw-size`.
+
+The firmware build runs this script when `CONFIG_FRAME_SOURCE_REPLAY` is set.
+"""
+import argparse
+import os
+import re
+
+
+def read_pgm(path):
+    """Reads an 8-bit PGM file.
+
+    Args:
+        path (str): Path of the file.
+
+    Returns:
+        tuple[int, int, bytes]: Width, height and row-major pixels.
+    """
+    with open(path, "rb") as f:
+        data = f.read()
+
+    # Header: magic, width, height, maxval, separated by whitespace and comments
+    tokens = []
+    pos = 0
+    while len(tokens) < 4:
+        match = re.compile(rb"\s*(#[^\n]*\n\s*)*(\S+)").match(data, pos)
+        if not match:
+            raise ValueError(f"{path}: truncated PGM header")
+        tokens.append(match.group(2))
+        pos = match.end()
+    magic, width, height, maxval = tokens[0], int(tokens[1]), int(tokens[2]), int(tokens[3])
+    if maxval > 255:
+        raise ValueError(f"{path}: only 8-bit PGM files are supported")
+
+    if magic == b"P5":
+        pixels = data[pos + 1:pos + 1 + width * height]
+    elif magic == b"P2":
+        pixels = bytes(int(v) for v in data[pos:].split()[:width * height])
+    else:
+        raise ValueError(f"{path}: not a PGM file")
+    if len(pixels) != width * height:
+        raise ValueError(f"{path}: expected {width * height} pixels, got {len(pixels)}")
+
+    if maxval != 255:
+        pixels = bytes(p * 255 // maxval for p in pixels)
+    return width, height, pixels
+
+
+def read_raw(path, default_size):
+    """Reads a raw 8-bit grayscale file.
+
+    Args:
+        path (str): Path of the file.
+        default_size (tuple[int, int]): Size used when the name has no `_WxH` suffix.
+
+    Returns:
+        tuple[int, int, bytes]: Width, height and row-major pixels.
+    """
+    match = re.search(r"_(\d+)x(\d+)\.raw$", path)
+    width, height = (int(match.group(1)), int(match.group(2))) if match else default_size
+    with open(path, "rb") as f:
+        pixels = f.read()
+    if len(pixels) != width * height:
+        raise ValueError(f"{path}: expected {width}x{height} = {width * height} bytes, got {len(pixels)}")
+    return width, height, pixels
+
+
+def write_frames(frames, cc_path):
+    """Writes the frames as the C++ replay_frames table.
+
+    Args:
+        frames (list[tuple[str, int, int, bytes]]): Name, width, height and pixels of every frame.
+        cc_path (str): Path of the generated source file.
+    """
+    with open(cc_path, "w") as f:
+        f.write('#include "frame_source.h"\n\n')
+        for i, (_, _, _, pixels) in enumerate(frames):
+            f.write(f"static const uint8_t frame_{i}[] = {{\n")
+            lines = ["  " + ", ".join(f"0x{b:02x}" for b in pixels[j:j + 16])
+                     for j in range(0, len(pixels), 16)]
+            f.write(",\n".join(lines))
+            f.write("\n};\n\n")
+
+        f.write("const ReplayFrame replay_frames[] = {\n")
+        for i, (name, width, height, _) in enumerate(frames):
+            f.write(f'  {{"{name}", {width}, {height}, frame_{i}}},\n')
+        if not frames:
+            f.write('  {"", 0, 0, nullptr},\n')
+        f.write("};\n")
+        f.write(f"const size_t replay_frames_count = {len(frames)};\n")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("directory", help="directory with .pgm and .raw frames")
+    parser.add_argument("output", help="generated C++ source file")
+    parser.add_argument("--raw-size", default="96x96",
+                        help="WIDTHxHEIGHT of raw files without a size suffix (default 96x96)")
+    args = parser.parse_args()
+
+    raw_size = tuple(int(v) for v in args.raw_size.split("x"))
+    frames = []
+    names = sorted(os.listdir(args.directory)) if os.path.isdir(args.directory) else []
+    for name in names:
+        path = os.path.join(args.directory, name)
+        if name.lower().endswith(".pgm"):
+            width, height, pixels = read_pgm(path)
+        elif name.lower().endswith(".raw"):
+            width, height, pixels = read_raw(path, raw_size)
+        else:
+            continue
+        frames.append((name, width, height, pixels))
+
+    if not frames:
+        print(f"warning: no .pgm or .raw frames in {args.directory}")
+    write_frames(frames, args.output)
+    print(f"Embedded {len(frames)} frames in {args.output}")
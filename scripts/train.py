@@ -9,8 +9,36 @@ import torch.optim as optim
 import torch.nn as nn
 from torch.utils.data import DataLoader
 from torchvision import datasets, transforms
+import json
 import os
 
+VAL_INDICES_PATH = "../models/val_indices.json"
+
+
+def validation_indices(num_images):
+    """Returns the dataset indices of the validation split of `train_model()`.
+
+    Uses the indices `train_model()` saved. Without them, the split is redone
+    with this script's random number sequence: seeding, initializing the
+    model's weights and only then splitting.
+
+    Args:
+        num_images (int): Number of images in the dataset.
+
+    Returns:
+        list[int]: The validation indices.
+    """
+    if os.path.exists(VAL_INDICES_PATH):
+        with open(VAL_INDICES_PATH) as f:
+            return json.load(f)
+
+    print(f"{VAL_INDICES_PATH} not found, repeating the split of train.py")
+    torch.manual_seed(42)
+    cnn.CNN()  # consumes the same random numbers as the trained model's initialization
+    train_size = int(0.8 * num_images)
+    _, val_subset = torch.utils.data.random_split(range(num_images), [train_size, num_images - train_size])
+    return list(val_subset.indices)
+
 
 def train_model(model):
     """Trains the provided CNN model using the HG14 hand gesture dataset.
@@ -40,6 +68,11 @@ def train_model(model):
     val_size = len(dataset) - train_size
     train_dataset, val_dataset = torch.utils.data.random_split(dataset, [train_size, val_size])
 
+    # Saved so scripts/compare_models.py evaluates on exactly these images
+    os.makedirs(os.path.dirname(VAL_INDICES_PATH), exist_ok=True)
+    with open(VAL_INDICES_PATH, "w") as f:
+        json.dump(list(val_dataset.indices), f)
+
     train_loader = DataLoader(train_dataset, batch_size=batch_size, shuffle=True)
     val_loader = DataLoader(val_dataset, batch_size=batch_size, shuffle=False)
 